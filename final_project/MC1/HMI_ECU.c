@@ -6,216 +6,515 @@
  */
 
 #include "timer.h"
+#include "sw_timer.h"
+#include "idle.h"
 #include "lcd.h"
 #include "keypad.h"
 #include "uart.h"
+#include "protocol.h"
+#include "event.h"
+#include "kernel.h"
 #include "micro_config.h"
-#include "util/delay.h"
 
+/* How long a message stays on the LCD, in milliseconds */
 #define DELAY_Keypad 2000
-#define DELAY_UART 100
+
+/* The keypad is scanned every KEYPAD_SCAN_MS Timer0 ticks */
+#define KEYPAD_SCAN_MS 10
+
+/* Keypad button that submits a password */
+#define KEY_ENTER 13
+
+/*******************************************************************************
+ *                           Types Declaration                            	   *
+ *******************************************************************************/
+
+/* UI screens, each one has its own event handler in g_screenHandlers */
+typedef enum {
+	SCREEN_PASSWORD,	/* typing the passwords of g_operation */
+	SCREEN_MENU,		/* - to change the password, + to open */
+	SCREEN_WAITING,		/* request sent, waiting for CONTROL_ECU */
+	SCREEN_MESSAGE,		/* message shown for DELAY_Keypad, then g_nextScreen */
+	SCREEN_DOOR,		/* door cycle, one step per screen timer */
+	SCREEN_LOCKOUT,		/* too many wrong passwords */
+	SCREEN_COUNT
+} UI_screen;
+
+/* Data of the EVENT_TIMER events */
+typedef enum {
+	UI_TIMER_SCREEN, UI_TIMER_RESPONSE
+} UI_timer;
+
+typedef void (*UI_handler)(const EVENT_event *event);
 
 /*******************************************************************************
  *                           Function Prototype                           	   *
  *******************************************************************************/
 
-void EnterPW(uint8 PW[]);
-void SendPW_UART(uint8 PW[]);
-void timer0_isr_fn(void);
+void PasswordScreen(const EVENT_event *event);
+void MenuScreen(const EVENT_event *event);
+void WaitingScreen(const EVENT_event *event);
+void MessageScreen(const EVENT_event *event);
+void DoorScreen(const EVENT_event *event);
+void LockoutScreen(const EVENT_event *event);
+
+void ShowPassword(uint8 operation);
+void ShowPasswordField(void);
+void ShowMenu(void);
+void ShowMessage(uint8 col, const char *message, uint8 next);
+void ShowDoorStep(void);
+void ShowLockout(void);
+void SendRequest(void);
+void HandleVerdict(uint8 verdict, const char *invalid_message, uint8 col);
+
+void EventLoop(void);
+void KeypadScan(void);
+void UartReceived(void);
+void ScreenTimerExpired(void);
+void ResponseTimerExpired(void);
 
 /*******************************************************************************
  *                           Global Variables	                          	   *
  *******************************************************************************/
 
-int quarter_sec = 0;
+/* Indexed by UI_screen */
+UI_handler const g_screenHandlers[SCREEN_COUNT] = { PasswordScreen, MenuScreen,
+		WaitingScreen, MessageScreen, DoorScreen, LockoutScreen };
+
+uint8 g_screen;
+
+/* Screen shown when the SCREEN_MESSAGE time is over */
+uint8 g_nextScreen;
+
+/* Request being typed or sent: OP_SET_PW, OP_CHANGE_PW or OP_OPEN */
+uint8 g_operation;
+
+/* Up to three passwords: old, new and confirmation */
+uint8 g_credentials[3 * PROTOCOL_PW_LENGTH];
+
+/* Password being typed and the digits typed in it */
+uint8 g_field;
+uint8 g_digits;
+
+/* Times the current request has been sent */
+uint8 g_sendCount;
+
+/* Sequence number of the current request, the same for all its sends */
+uint8 g_sequence;
+
+uint8 g_doorStep;
+
+SW_timer_id g_responseTimer = SW_TIMER_INVALID;
+
+/* Frame handed to the screen handler with EVENT_FRAME */
+PROTOCOL_frame g_frame;
+
+/* An EVENT_UART_RX is queued and not handled yet, set by the Rx ISR */
+volatile uint8 g_rxPosted = FALSE;
+
+#if KERNEL_ENABLED
+/* The event loop runs as the only kernel task */
+#define EVENT_STACK_SIZE 256
+#define EVENT_PRIORITY 1
+
+uint8 g_eventStack[EVENT_STACK_SIZE];
+#endif
+
+/* Door cycle steps shown by SCREEN_DOOR */
+const char *const g_doorText[] = { "Opening Door", "Door Open", "Closing Door" };
+const uint8 g_doorSeconds[] = { PROTOCOL_DOOR_OPENING_SECONDS,
+		PROTOCOL_DOOR_HOLD_SECONDS, PROTOCOL_DOOR_CLOSING_SECONDS };
 
 /*******************************************************************************
  *                           Main Function		                          	   *
  *******************************************************************************/
 
 int main(void) {
-
-	uint8 PW[4];
-	uint8 confirm_pw[4];
-	uint8 command;
-	volatile uint8 check_pw;
-	Timer0_setCallBack(timer0_isr_fn);
+	SWTIMER_init();
 
 	LCD_init();
 	LCD_clearScreen();
 
-	/* Asynchronous, even parity and one stop bit  */
+	/* Asynchronous, even parity, one stop bit and 9-bit multidrop frames */
 	USART_configuration UConfig =
-			{ ENABLED_EVEN, BIT_1, BIT_8, ASYNCH, FALLING };
+			{ ENABLED_EVEN, BIT_1, BIT_9, ASYNCH, FALLING };
 	UART_init(&UConfig);
 
-	/* Timer configurations */
-	timer_configuration T0_Configuration = { NORMAL_MODE, F_CPU_1024, TIMER0,
-			0, 7812 };
+	/* Received bytes are turned into EVENT_UART_RX */
+	UART_setRxCallBack(UartReceived);
+
+	/* Pressed keys are turned into EVENT_KEY by the 1 ms tick */
+	Timer_subscribe(TIMER0_COMP, KeypadScan, KEYPAD_SCAN_MS);
+
+	/* Timer0 as the 1 ms system tick */
+	timer_configuration T0_Configuration = { CTC_MODE, TIMER0_TICK_PRESCALER,
+			TIMER0, TIMER0_TICK_COMPARE, 0 };
 
 	/* Initialize Timer0 */
 	Timer_Init(&T0_Configuration);
 
+	/* Sleep in idle mode whenever there is nothing to do */
+	IDLE_init();
+
 	/* Enable global interrupt register */
 	/* SREG |= (1 << 7); */
 
-	/*******************************************************************************
-	 *                     Entering the password for the first time                *
-	 *******************************************************************************/
+	/* Entering the password for the first time */
+	ShowPassword(OP_SET_PW);
 
-	do {
+#if KERNEL_ENABLED
+	KERNEL_createTask(EventLoop, EVENT_PRIORITY, g_eventStack,
+			EVENT_STACK_SIZE);
 
-		LCD_clearScreen();
-		LCD_displayString("Enter Password");
+	/* Never returns, main becomes the idle task */
+	KERNEL_start();
+#else
+	EventLoop();
+#endif
+}
 
-		/* Send Address OF password[4] TO EnterPW() */
-		EnterPW(PW);
-		_delay_ms(DELAY_UART);
+/*******************************************************************************
+ *                 Event loop, every handler runs to completion                *
+ *******************************************************************************/
 
-		SendPW_UART(PW);
+void EventLoop(void) {
+	EVENT_event event;
 
-		/* Entering the password again */
-		LCD_clearScreen();
-		LCD_displayString("Re-Enter PW");
+	while (1) {
+		EVENT_wait(&event);
+
+		if (event.type == EVENT_UART_RX) {
+			/* Let the Rx ISR post again before draining, so no byte is left behind */
+			g_rxPosted = FALSE;
+
+			event.type = EVENT_FRAME;
+			while (PROTOCOL_pollFrame(&g_frame) == TRUE) {
+				g_screenHandlers[g_screen](&event);
+			}
+		} else {
+			g_screenHandlers[g_screen](&event);
+		}
+	}
+}
+
+/*******************************************************************************
+ *                           Screen Handlers	                          	   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Collect PROTOCOL_PW_LENGTH digits per password, KEY_ENTER moves to the
+ * next password and sends the request after the last one.
+ */
+void PasswordScreen(const EVENT_event *event) {
+	uint8 fields = (PROTOCOL_REQUEST_LENGTH(g_operation) - PROTOCOL_PW_FIELD(0))
+			/ PROTOCOL_PW_LENGTH;
+
+	if (event->type != EVENT_KEY) {
+		return;
+	}
 
-		EnterPW(confirm_pw);
-		_delay_ms(DELAY_UART);
+	if ((event->data <= 9) && (g_digits < PROTOCOL_PW_LENGTH)) {
+		g_credentials[(g_field * PROTOCOL_PW_LENGTH) + g_digits] = event->data;
+		g_digits++;
+		LCD_displayCharacter('*');
+
+	} else if ((event->data == KEY_ENTER) && (g_digits == PROTOCOL_PW_LENGTH)) {
+		g_field++;
+		if (g_field < fields) {
+			ShowPasswordField();
+		} else {
+			g_sendCount = 0;
+			g_sequence++;
+			SendRequest();
+		}
+	}
+}
 
-		SendPW_UART(confirm_pw);
+/*
+ * Description :
+ * '-' changes the password and '+' opens the door.
+ */
+void MenuScreen(const EVENT_event *event) {
+	if (event->type != EVENT_KEY) {
+		return;
+	}
+
+	if (event->data == '-') {
+		ShowPassword(OP_CHANGE_PW);
+	} else if (event->data == '+') {
+		ShowPassword(OP_OPEN);
+	}
+}
 
-		/* MCU2 will check if password is valid or not */
-		check_pw = UART_receiveByte();
+/*
+ * Description :
+ * Wait for the MSG_RESPONSE matching the request. The request is sent again
+ * if no response comes in time, if CONTROL_ECU never answers the link is
+ * reported lost. A lost link is not a wrong password: nothing is counted and
+ * the user starts over.
+ */
+void WaitingScreen(const EVENT_event *event) {
+	if (event->type == EVENT_FRAME) {
+		/* Any other message, or a late answer to an older request, is skipped */
+		if ((g_frame.type == MSG_RESPONSE)
+				&& (g_frame.length == PROTOCOL_RESPONSE_LENGTH)
+				&& (g_frame.payload[PROTOCOL_OPERATION_FIELD] == g_operation)
+				&& (g_frame.payload[PROTOCOL_SEQUENCE_FIELD] == g_sequence)) {
+			SWTIMER_cancel(g_responseTimer);
+			HandleVerdict(g_frame.payload[PROTOCOL_VERDICT_FIELD], "INVALID", 4);
+		}
 
-		/* Send message to user if not valid */
-		if (check_pw == 0) {
-			LCD_clearScreen();
-			LCD_displayStringRowColumn(0, 4, "INVALID");
-			_delay_ms(DELAY_Keypad);
+	} else if ((event->type == EVENT_TIMER)
+			&& (event->data == UI_TIMER_RESPONSE)) {
+		if (g_sendCount < PROTOCOL_MAX_RETRIES) {
+			PROTOCOL_countRetry();
+			SendRequest();
+		} else {
+			ShowMessage(3, "LINK ERROR",
+					(g_operation == OP_SET_PW) ? SCREEN_PASSWORD : SCREEN_MENU);
 		}
-		/* If password is valid, get out of the while loop */
+	}
+}
+
+/*
+ * Description :
+ * Keys are ignored until the message time is over.
+ */
+void MessageScreen(const EVENT_event *event) {
+	if ((event->type != EVENT_TIMER) || (event->data != UI_TIMER_SCREEN)) {
+		return;
+	}
 
-	} while (check_pw == 0);
+	if (g_nextScreen == SCREEN_PASSWORD) {
+		/* Type the passwords of the same request again */
+		ShowPassword(g_operation);
+	} else if (g_nextScreen == SCREEN_LOCKOUT) {
+		ShowLockout();
+	} else {
+		ShowMenu();
+	}
+}
+
+/*
+ * Description :
+ * DOOR OPENS IN 15 SECONDS AND STAYS OPENED FOR 3 SECONDS AND STARTS
+ * CLOSING AGAIN IN 15 SECONDS, the same steps CONTROL_ECU runs the motor.
+ */
+void DoorScreen(const EVENT_event *event) {
+	if ((event->type != EVENT_TIMER) || (event->data != UI_TIMER_SCREEN)) {
+		return;
+	}
+
+	g_doorStep++;
+	if (g_doorStep < (sizeof(g_doorSeconds) / sizeof(g_doorSeconds[0]))) {
+		ShowDoorStep();
+	} else {
+		ShowMenu();
+	}
+}
+
+/*
+ * Description :
+ * MC1 is locked, keys are ignored until PROTOCOL_LOCKOUT_SECONDS are over.
+ */
+void LockoutScreen(const EVENT_event *event) {
+	if ((event->type == EVENT_TIMER) && (event->data == UI_TIMER_SCREEN)) {
+		ShowMenu();
+	}
+}
+
+/*******************************************************************************
+ *                           Screen Transitions	                          	   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Start typing the passwords of a request from the first one.
+ */
+void ShowPassword(uint8 operation) {
+	g_operation = operation;
+	g_field = 0;
+	ShowPasswordField();
+}
+
+/*
+ * Description :
+ * Prompt for password number g_field of g_operation.
+ */
+void ShowPasswordField(void) {
 	LCD_clearScreen();
-	LCD_displayString("Correct");
-	_delay_ms(DELAY_Keypad);
 
-	/*******************************************************************************
-	 *                             Change the password                        	   *
-	 *******************************************************************************/
-	while (1) {
-		LCD_clearScreen();
-		LCD_displayStringRowColumn(0, 0, "- to CHANGE PW");
-		LCD_displayStringRowColumn(1, 0, "+ to OPEN");
-
-		/* Send your choice to MC2 */
-		command = KEYPAD_getPressedKey();
-		_delay_ms(DELAY_Keypad);
-		UART_sendByte(command);
-		_delay_ms(DELAY_UART);
-
-		/********************************************************************************
-		 *                             ' - ' IS PRESSED                   	        *
-		 ********************************************************************************/
-
-		if (command == '-') {
-			do {
-				LCD_clearScreen();
-				LCD_displayString("Enter Password");
-
-				/* Send Address OF password[4] TO EnterPW() */
-				EnterPW(PW);
-				_delay_ms(DELAY_UART);
-
-				SendPW_UART(PW);
-
-				/* Entering the password again */
-				LCD_clearScreen();
-				LCD_displayString("Re-Enter PW");
-
-				EnterPW(confirm_pw);
-				_delay_ms(DELAY_UART);
-
-				SendPW_UART(confirm_pw);
-
-				/* MCU2 will check if password is valid or not */
-				check_pw = UART_receiveByte();
-
-				/* Send message to user if not valid */
-				if (check_pw == 0) {
-					LCD_clearScreen();
-					LCD_displayStringRowColumn(0, 4, "INVALID");
-					_delay_ms(DELAY_Keypad);
-				}
-				/* If password is valid, get out of the while loop */
-
-			} while (check_pw == 0);
-			LCD_clearScreen();
-			LCD_displayString("Password Changed");
-			_delay_ms(DELAY_Keypad);
+	if (g_operation == OP_CHANGE_PW) {
+		if (g_field == 0) {
+			LCD_displayString("Enter Old PW");
+		} else if (g_field == 1) {
+			LCD_displayString("Enter New PW");
+		} else {
+			LCD_displayString("Re-Enter PW");
 		}
+	} else if (g_field == 0) {
+		LCD_displayString("Enter Password");
+	} else {
+		LCD_displayString("Re-Enter PW");
+	}
 
-		/********************************************************************************
-		 *                             ' + ' IS PRESSED                   	            *
-		 ********************************************************************************/
-
-		else if (command == '+') {
-
-			/* This variable is used to count the number of invalid entries */
-			uint8 count = 0;
-
-			do {
-				count++;
-
-				LCD_clearScreen();
-				LCD_displayString("Enter Password");
-				EnterPW(PW);
-				SendPW_UART(PW);
-
-				/* MCU2 will check if password is valid or not */
-				check_pw = UART_receiveByte();
-				_delay_ms(DELAY_UART);
-
-				if (check_pw == 0) {
-					LCD_clearScreen();
-					LCD_displayStringRowColumn(0, 4, "INVALID");
-					_delay_ms(DELAY_Keypad);
-				}
-
-				/* Polling */
-				/* If the password has been entered wrongly for three times */
-			} while (check_pw == 0 && count < 3);
-
-			if (check_pw) {
-
-				/* DOOR OPENS IN 15 SECONDS AND STAYS OPENED FOR 3 SECONDS AND STARTS
-				 *  CLOSING AGAIN IN 15 SECONDS */
-
-				SECONDS_T0_MC1 = 0;
-				LCD_clearScreen();
-				LCD_displayString("Opening Door");
-				while (SECONDS_T0_MC1 <= 15)
-					;
-				LCD_clearScreen();
-				LCD_displayString("Door Open");
-				while (SECONDS_T0_MC1 <= 18)
-					;
-				LCD_clearScreen();
-				LCD_displayString("Closing Door");
-				while (SECONDS_T0_MC1 <= 33)
-					;
-			}
-			// if password do not match so turn on buzzer
-			else if (check_pw == 0) {
-				LCD_clearScreen();
-				LCD_displayStringRowColumn(0, 5, "ERROR");
-				SECONDS_T0_MC1 = 0;
-
-				/* Polling */
-				/* Lock MC1 for 60 seconds */
-				while (SECONDS_T0_MC1 < 60)
-					;
-			}
+	LCD_moveCursor(1, 0);
+	g_digits = 0;
+	g_screen = SCREEN_PASSWORD;
+}
+
+void ShowMenu(void) {
+	LCD_clearScreen();
+	LCD_displayStringRowColumn(0, 0, "- to CHANGE PW");
+	LCD_displayStringRowColumn(1, 0, "+ to OPEN");
+	g_screen = SCREEN_MENU;
+}
+
+/*
+ * Description :
+ * Show a message for DELAY_Keypad, then go to the next screen.
+ */
+void ShowMessage(uint8 col, const char *message, uint8 next) {
+	LCD_clearScreen();
+	LCD_displayStringRowColumn(0, col, message);
+	SWTIMER_start(DELAY_Keypad, 0, ScreenTimerExpired);
+	g_nextScreen = next;
+	g_screen = SCREEN_MESSAGE;
+}
+
+/*
+ * Description :
+ * Show door cycle step g_doorStep until its time is over.
+ */
+void ShowDoorStep(void) {
+	LCD_clearScreen();
+	LCD_displayString(g_doorText[g_doorStep]);
+	SWTIMER_start(SW_TIMER_SECONDS(g_doorSeconds[g_doorStep]), 0,
+			ScreenTimerExpired);
+	g_screen = SCREEN_DOOR;
+}
+
+/*
+ * Description :
+ * If password do not match so turn on buzzer, Lock MC1 for 60 seconds.
+ */
+void ShowLockout(void) {
+	LCD_clearScreen();
+	LCD_displayStringRowColumn(0, 5, "ERROR");
+	SWTIMER_start(SW_TIMER_SECONDS(PROTOCOL_LOCKOUT_SECONDS), 0, ScreenTimerExpired);
+	g_screen = SCREEN_LOCKOUT;
+}
+
+/*
+ * Description :
+ * Send the operation and its passwords to CONTROL_ECU as one MSG_REQUEST
+ * frame and wait for the response in SCREEN_WAITING.
+ */
+void SendRequest(void) {
+	uint8 payload[PROTOCOL_MAX_PAYLOAD];
+	uint8 length = PROTOCOL_REQUEST_LENGTH(g_operation);
+
+	payload[PROTOCOL_OPERATION_FIELD] = g_operation;
+	payload[PROTOCOL_SEQUENCE_FIELD] = g_sequence;
+	for (uint8 i = PROTOCOL_PW_FIELD(0); i < length; i++) {
+		payload[i] = g_credentials[i - PROTOCOL_PW_FIELD(0)];
+	}
+
+	/* Only the addressed door controller listens to the request */
+	UART_selectNode(PROTOCOL_NODE_ADDRESS);
+	PROTOCOL_sendFrame(MSG_REQUEST, payload, length);
+	g_sendCount++;
+
+	g_responseTimer = SWTIMER_start(PROTOCOL_RESPONSE_TIMEOUT_MS, 0,
+			ResponseTimerExpired);
+	g_screen = SCREEN_WAITING;
+}
+
+/*
+ * Description :
+ * Go on with the verdict of CONTROL_ECU, invalid_message is shown if the
+ * request was refused. CONTROL_ECU counts the wrong passwords, the lockout
+ * starts only when it reports the alarm.
+ */
+void HandleVerdict(uint8 verdict, const char *invalid_message, uint8 col) {
+	if (verdict == VERDICT_BUSY) {
+		/* The door is still running a cycle, nothing was done */
+		ShowMessage(3, "DOOR BUSY", SCREEN_MENU);
+
+	} else if (verdict == VERDICT_ERROR) {
+		/* CONTROL_ECU could not save the new password, the old one still holds */
+		ShowMessage(3, "SAVE ERROR",
+				(g_operation == OP_SET_PW) ? SCREEN_PASSWORD : SCREEN_MENU);
+
+	} else if (verdict == VERDICT_PW_SET) {
+		/* CONTROL_ECU kept its password over a reset, it is still in use */
+		ShowMessage(1, "PW ALREADY SET", SCREEN_MENU);
+
+	} else if (verdict == VERDICT_NO_PW) {
+		/* CONTROL_ECU has no password yet, set one first */
+		g_operation = OP_SET_PW;
+		ShowMessage(2, "NO PASSWORD", SCREEN_PASSWORD);
+
+	} else if (g_operation == OP_OPEN) {
+		if (verdict == VERDICT_VALID) {
+			g_doorStep = 0;
+			ShowDoorStep();
+		} else {
+			ShowMessage(col, invalid_message,
+					(verdict == VERDICT_LOCKOUT) ? SCREEN_LOCKOUT : SCREEN_PASSWORD);
 		}
+
+	} else if (verdict == VERDICT_VALID) {
+		ShowMessage(0,
+				(g_operation == OP_SET_PW) ? "Correct" : "Password Changed",
+				SCREEN_MENU);
+	} else {
+		ShowMessage(col, invalid_message, SCREEN_PASSWORD);
 	}
+}
+
+/*******************************************************************************
+ *                           Event Sources		                          	   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Timer0 compare subscriber, every KEYPAD_SCAN_MS. A key counts once it reads
+ * the same on two scans in a row, and only once until it is released.
+ */
+void KeypadScan(void) {
+	static uint8 last = KEYPAD_NO_KEY;
+	static uint8 reported = KEYPAD_NO_KEY;
+	uint8 key = KEYPAD_scan();
+
+	if ((key == last) && (key != reported)) {
+		reported = key;
+		if (key != KEYPAD_NO_KEY) {
+			EVENT_post(EVENT_KEY, key);
+		}
+	}
+	last = key;
+}
+
+/*
+ * Description :
+ * UART Rx callback, one EVENT_UART_RX at a time is enough to drain the buffer.
+ */
+void UartReceived(void) {
+	if (g_rxPosted == FALSE) {
+		g_rxPosted = EVENT_post(EVENT_UART_RX, 0);
+	}
+}
+
+/*
+ * Description :
+ * Software timer callbacks, run in the Timer0 interrupt.
+ */
+void ScreenTimerExpired(void) {
+	EVENT_post(EVENT_TIMER, UI_TIMER_SCREEN);
+}
 
+void ResponseTimerExpired(void) {
+	EVENT_post(EVENT_TIMER, UI_TIMER_RESPONSE);
 }
@@ -0,0 +1,126 @@
+/******************************************************************************
+ *
+ * Module: EVENT
+ *
+ * File Name: event.c
+ *
+ * Description: Source file for the event queue of the HMI main loop
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "event.h"
+#include "idle.h"
+#include "kernel.h"
+#include "spsc.h"
+#include "micro_config.h" /* To use SREG and cli */
+
+/*******************************************************************************
+ *                      Global Variables (Private)                             *
+ *******************************************************************************/
+
+/*
+ * Several ISRs and the main loop post events, the main loop takes them.
+ * The posts are serialized by masking the interrupts so the queue sees a
+ * single producer, the main loop takes the events without masking them.
+ */
+SPSC_QUEUE(EVENT_queue, EVENT_event, EVENT_QUEUE_SIZE)
+
+static EVENT_queue g_events;
+
+/* Set by every post, wakes EVENT_wait up */
+static volatile uint8 g_posted = FALSE;
+
+static volatile uint16 g_dropped = 0;
+
+#if KERNEL_ENABLED
+/* Given by every post, the task in EVENT_wait blocks on it */
+static KERNEL_semaphore g_postedSem;
+#endif
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Queue an event, callable from the ISRs and from the main loop.
+ * Return FALSE and count the event as dropped if the queue is full.
+ */
+boolean EVENT_post(EVENT_type type, uint8 data) {
+	EVENT_event event;
+	boolean posted;
+	uint8 sreg = SREG;
+
+	event.type = type;
+	event.data = data;
+
+	cli();
+	posted = EVENT_queue_push(&g_events, &event);
+	if (posted == TRUE) {
+		g_posted = TRUE;
+	} else {
+		g_dropped++;
+	}
+	SREG = sreg;
+
+#if KERNEL_ENABLED
+	if (posted == TRUE) {
+		KERNEL_semGive(&g_postedSem);
+	}
+#endif
+
+	return posted;
+}
+
+/*
+ * Description :
+ * Take the oldest event without waiting, return FALSE if there is none.
+ */
+boolean EVENT_get(EVENT_event *event) {
+	return EVENT_queue_pop(&g_events, event);
+}
+
+/*
+ * Description :
+ * Sleep in idle mode until an event is queued, then take the oldest one.
+ * On the kernel the calling task blocks instead and the idle task sleeps.
+ */
+void EVENT_wait(EVENT_event *event) {
+	while (1) {
+		/* A post after this still wakes the wait below up */
+		g_posted = FALSE;
+		if (EVENT_get(event) == TRUE) {
+			return;
+		}
+#if KERNEL_ENABLED
+		KERNEL_semTake(&g_postedSem, KERNEL_WAIT_FOREVER);
+#else
+		IDLE_waitUntil(&g_posted);
+#endif
+	}
+}
+
+/*
+ * Description :
+ * Number of events dropped because the queue was full.
+ */
+uint16 EVENT_getDropped(void) {
+	uint16 dropped;
+	uint8 sreg = SREG;
+
+	cli();
+	dropped = g_dropped;
+	SREG = sreg;
+
+	return dropped;
+}
+
+/*
+ * Description :
+ * Most events ever waiting at the same time, to size EVENT_QUEUE_SIZE.
+ */
+uint8 EVENT_getHighWater(void) {
+	return EVENT_queue_highWater(&g_events);
+}
@@ -0,0 +1,81 @@
+/******************************************************************************
+ *
+ * Module: EVENT
+ *
+ * File Name: event.h
+ *
+ * Description: Header file for the event queue of the HMI main loop
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Events waiting at the same time, must be a power of two */
+#define EVENT_QUEUE_SIZE				16
+
+#if (EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)) || (EVENT_QUEUE_SIZE > 128)
+#error "EVENT_QUEUE_SIZE must be a power of two up to 128"
+#endif
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+typedef enum {
+	EVENT_KEY,		/* data: the debounced key pressed */
+	EVENT_UART_RX,	/* bytes are waiting in the UART Rx buffer */
+	EVENT_FRAME,	/* a complete frame was parsed from the Rx buffer */
+	EVENT_TIMER		/* data: which software timer expired */
+} EVENT_type;
+
+typedef struct {
+	uint8 type;
+	uint8 data;
+} EVENT_event;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Queue an event, callable from the ISRs and from the main loop.
+ * Return FALSE and count the event as dropped if the queue is full.
+ */
+boolean EVENT_post(EVENT_type type, uint8 data);
+
+/*
+ * Description :
+ * Take the oldest event without waiting, return FALSE if there is none.
+ */
+boolean EVENT_get(EVENT_event *event);
+
+/*
+ * Description :
+ * Sleep in idle mode until an event is queued, then take the oldest one.
+ * On the kernel the calling task blocks instead and the idle task sleeps.
+ */
+void EVENT_wait(EVENT_event *event);
+
+/*
+ * Description :
+ * Number of events dropped because the queue was full.
+ */
+uint16 EVENT_getDropped(void);
+
+/*
+ * Description :
+ * Most events ever waiting at the same time, to size EVENT_QUEUE_SIZE.
+ */
+uint8 EVENT_getHighWater(void);
+
+#endif /* EVENT_H_ */
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *
+ * Module: IDLE
+ *
+ * File Name: idle.h
+ *
+ * Description: Header file for the idle manager, sleeps between interrupts
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef IDLE_H_
+#define IDLE_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+/* Time spent since IDLE_init or IDLE_clearStatistics */
+typedef struct {
+	uint32 asleep_ms;
+	uint32 awake_ms;
+	uint32 wakeups;
+} IDLE_statistics;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Select SLEEP_MODE_IDLE and start the statistics. The timers, the UART and
+ * the TWI keep running in idle mode and any of their interrupts wakes the CPU.
+ */
+void IDLE_init(void);
+
+/*
+ * Description :
+ * Sleep until the next interrupt (at most one 1 ms tick), for polling loops.
+ * A condition that turns true between its check and the sleep is seen one
+ * tick late. Returns at once if the global interrupts are disabled.
+ */
+void IDLE_sleep(void);
+
+/*
+ * Description :
+ * Sleep until an interrupt sets *flag to a non zero value. The flag is checked
+ * with interrupts disabled, so no wakeup can be missed.
+ */
+void IDLE_waitUntil(volatile uint8 *flag);
+
+/*
+ * Description :
+ * Copy the asleep/awake time and the number of wakeups to stats.
+ */
+void IDLE_getStatistics(IDLE_statistics *stats);
+
+/*
+ * Description :
+ * Restart the statistics from zero.
+ */
+void IDLE_clearStatistics(void);
+
+#endif /* IDLE_H_ */
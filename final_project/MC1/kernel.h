@@ -0,0 +1,180 @@
+/******************************************************************************
+ *
+ * Module: KERNEL
+ *
+ * File Name: kernel.h
+ *
+ * Description: Header file for the optional preemptive priority kernel
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef KERNEL_H_
+#define KERNEL_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Build the ECUs on the kernel instead of their superloop. Off by default,
+ * the superloop is enough for one door; the kernel is for the deployments
+ * that have to meet deadlines while busy (multi-door, logging, console).
+ */
+#ifndef KERNEL_ENABLED
+#define KERNEL_ENABLED					0
+#endif
+
+/* Tasks that can be created, the idle task (the caller of KERNEL_start) is extra */
+#ifndef KERNEL_MAX_TASKS
+#define KERNEL_MAX_TASKS				4
+#endif
+
+/*
+ * Smallest useful task stack: 35 bytes of saved context plus the ISRs, which
+ * run on the stack of whatever task they interrupt.
+ */
+#define KERNEL_MIN_STACK				96
+
+/* Stacks are filled with this byte to find their high-water mark */
+#define KERNEL_STACK_PAINT				0xA5
+
+#define KERNEL_INVALID_TASK				0xFF
+
+/* Timeouts of KERNEL_semTake/queueSend/queueReceive in 1 ms ticks */
+#define KERNEL_NO_WAIT					0
+#define KERNEL_WAIT_FOREVER				0xFFFF
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+typedef uint8 KERNEL_task_id;
+
+typedef enum {
+	KERNEL_READY, KERNEL_DELAYED, KERNEL_BLOCKED, KERNEL_ENDED
+} KERNEL_task_state;
+
+/* Counting semaphore, give it from tasks or ISRs */
+typedef struct {
+	volatile uint8 count;
+} KERNEL_semaphore;
+
+/* Queue of fixed size items in a buffer of capacity * item_size bytes */
+typedef struct {
+	uint8 *buffer;
+	uint8 item_size;
+	uint8 capacity;
+	uint8 head;
+	uint8 count;
+	KERNEL_semaphore items;
+	KERNEL_semaphore spaces;
+} KERNEL_queue;
+
+typedef struct {
+	uint8 priority;
+	KERNEL_task_state state;
+	uint16 stack_size;
+	uint16 stack_high_water; /* Most stack bytes ever used */
+} KERNEL_task_info;
+
+typedef struct {
+	uint32 switches;
+	uint16 last_cycles; /* Measured on TCNT0, TIMER0_TICK_DIVIDER resolution */
+	uint16 max_cycles;
+} KERNEL_switch_statistics;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Add a task running entry on its own stack (painted with KERNEL_STACK_PAINT).
+ * The highest priority ready task runs, equal priorities share the CPU one
+ * tick each. Returns KERNEL_INVALID_TASK if there is no room.
+ */
+KERNEL_task_id KERNEL_createTask(void (*entry)(void), uint8 priority,
+		uint8 *stack, uint16 stack_size);
+
+/*
+ * Description :
+ * Start the scheduler on the 1 ms Timer0 tick, never returns. The caller
+ * becomes the idle task (priority 0) that sleeps in idle mode. Call it last,
+ * after the other Timer0 compare subscribers, so they have all run when the
+ * kernel tick switches tasks.
+ */
+void KERNEL_start(void);
+
+/*
+ * Description :
+ * Let the other ready tasks of the same priority run.
+ */
+void KERNEL_yield(void);
+
+/*
+ * Description :
+ * Block the calling task for ticks milliseconds.
+ */
+void KERNEL_delay(uint16 ticks);
+
+/*
+ * Description :
+ * Set the initial count of a semaphore.
+ */
+void KERNEL_semInit(KERNEL_semaphore *sem, uint8 count);
+
+/*
+ * Description :
+ * Take the semaphore, waiting at most timeout ticks (KERNEL_NO_WAIT,
+ * KERNEL_WAIT_FOREVER). Never waits when called from an ISR.
+ * Return FALSE on timeout.
+ */
+boolean KERNEL_semTake(KERNEL_semaphore *sem, uint16 timeout);
+
+/*
+ * Description :
+ * Give the semaphore to the highest priority task waiting for it. From a task
+ * it switches at once if that task has a higher priority, from an ISR the
+ * switch is left to the next tick.
+ */
+void KERNEL_semGive(KERNEL_semaphore *sem);
+
+/*
+ * Description :
+ * Set up an empty queue on buffer (capacity * item_size bytes).
+ */
+void KERNEL_queueInit(KERNEL_queue *queue, uint8 *buffer, uint8 item_size,
+		uint8 capacity);
+
+/*
+ * Description :
+ * Copy an item to the queue, waiting at most timeout ticks for room.
+ * Return FALSE on timeout.
+ */
+boolean KERNEL_queueSend(KERNEL_queue *queue, const void *item,
+		uint16 timeout);
+
+/*
+ * Description :
+ * Copy the oldest item out of the queue, waiting at most timeout ticks for
+ * one. Return FALSE on timeout.
+ */
+boolean KERNEL_queueReceive(KERNEL_queue *queue, void *item, uint16 timeout);
+
+/*
+ * Description :
+ * Copy the priority, state and stack use of a task.
+ */
+void KERNEL_getTaskInfo(KERNEL_task_id id, KERNEL_task_info *info);
+
+/*
+ * Description :
+ * Copy the context switch count and duration.
+ */
+void KERNEL_getSwitchStatistics(KERNEL_switch_statistics *stats);
+
+#endif /* KERNEL_H_ */
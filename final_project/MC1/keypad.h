@@ -33,6 +33,9 @@
 #define KEYPAD_BUTTON_PRESSED            LOGIC_LOW
 #define KEYPAD_BUTTON_RELEASED           LOGIC_HIGH
 
+/* Returned by KEYPAD_scan when no button is pressed */
+#define KEYPAD_NO_KEY                    0xFF
+
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
@@ -43,4 +46,11 @@
  */
 uint8 KEYPAD_getPressedKey(void);
 
+/*
+ * Description :
+ * Scan the Keypad once without waiting, return the pressed button or
+ * KEYPAD_NO_KEY. Short enough to be called from a timer interrupt.
+ */
+uint8 KEYPAD_scan(void);
+
 #endif /* KEYPAD_H_ */
@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ * Module: PROTOCOL
+ *
+ * File Name: protocol.h
+ *
+ * Description: Header file for the framed HMI <-> CONTROL link protocol
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include "std_types.h"
+#include "uart.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Frame layout on the wire:
+ * | SOF | TYPE | LENGTH | PAYLOAD (LENGTH bytes) | CRC16 high | CRC16 low |
+ * The CRC-16/CCITT (poly 0x1021, seed 0xFFFF) covers TYPE, LENGTH and PAYLOAD.
+ *
+ * Every byte after the SOF that equals PROTOCOL_SOF or PROTOCOL_ESC is sent
+ * as PROTOCOL_ESC followed by the byte XOR PROTOCOL_ESC_XOR, and the CRC is
+ * computed before this escaping. A SOF on the wire always starts a frame, so
+ * the receiver drops a broken frame and resynchronises on the next SOF,
+ * never inside the frame that follows.
+ */
+#define PROTOCOL_SOF					0x7E
+#define PROTOCOL_ESC					0x7D
+#define PROTOCOL_ESC_XOR				0x20
+#define PROTOCOL_MAX_PAYLOAD			16
+#define PROTOCOL_CRC_SEED				0xFFFF
+
+/* How long the HMI waits for a MSG_RESPONSE and how often it sends a request */
+#define PROTOCOL_RESPONSE_TIMEOUT_MS	1000
+#define PROTOCOL_MAX_RETRIES			3
+
+/*
+ * Door sequence and alarm durations. CONTROL_ECU runs the motor and the
+ * buzzer for them, the HMI shows each step for the same time.
+ */
+#define PROTOCOL_DOOR_OPENING_SECONDS	15
+#define PROTOCOL_DOOR_HOLD_SECONDS		3
+#define PROTOCOL_DOOR_CLOSING_SECONDS	15
+#define PROTOCOL_LOCKOUT_SECONDS		60
+
+/*
+ * 9-bit multidrop address of the door controller. Every CONTROL_ECU on a
+ * shared line is built with its own address, the HMI selects one of them
+ * before each request.
+ */
+#ifndef PROTOCOL_NODE_ADDRESS
+#define PROTOCOL_NODE_ADDRESS			0x01
+#endif
+
+/* Password length exchanged between the two ECUs */
+#define PROTOCOL_PW_LENGTH				4
+
+/* Offsets inside the MSG_REQUEST and MSG_RESPONSE payloads */
+#define PROTOCOL_OPERATION_FIELD		0
+#define PROTOCOL_SEQUENCE_FIELD			1
+#define PROTOCOL_VERDICT_FIELD			2
+
+/* Offset of the n-th password inside a MSG_REQUEST payload */
+#define PROTOCOL_PW_FIELD(n)			(2 + ((n) * PROTOCOL_PW_LENGTH))
+
+#define PROTOCOL_RESPONSE_LENGTH		3
+
+/*
+ * MSG_REQUEST length of each operation:
+ * OP_OPEN: password, OP_SET_PW: password + confirmation,
+ * OP_CHANGE_PW: old password + new password + confirmation
+ */
+#define PROTOCOL_REQUEST_LENGTH(OP)		PROTOCOL_PW_FIELD(((OP) == OP_OPEN) ? 1 : \
+										((OP) == OP_SET_PW) ? 2 : 3)
+
+/*
+ * MSG_REQUEST payload:  | operation | sequence | password fields ... |
+ * MSG_RESPONSE payload: | operation | sequence | verdict |
+ * Each request is answered by exactly one response, which is also the
+ * signal that CONTROL_ECU is ready for the next request.
+ *
+ * The HMI gives every new request the next sequence number and sends it
+ * again unchanged after a timeout. CONTROL_ECU answers a request identical
+ * to the last one it handled with the same response again, without running
+ * it twice, so a retry never changes the password or counts a wrong
+ * password twice. The response carries the sequence of its request so a late
+ * answer to an older request is told apart.
+ */
+typedef enum {
+	MSG_REQUEST = 1, MSG_RESPONSE
+} PROTOCOL_message_type;
+
+typedef enum {
+	OP_ANY, OP_SET_PW, OP_OPEN, OP_CHANGE_PW
+} PROTOCOL_operation;
+
+/*
+ * VERDICT_LOCKOUT: OP_OPEN with the last wrong password allowed, the alarm is
+ * on. CONTROL_ECU alone counts the wrong passwords and forgets them after its
+ * retry window, the HMI only follows its verdicts.
+ * VERDICT_BUSY: the door is moving or the alarm is on, the request was not
+ * looked at and may be sent again once the door is closed.
+ * VERDICT_ERROR: the passwords were right but the new one could not be
+ * saved, the password in use has not changed.
+ * VERDICT_PW_SET: OP_SET_PW while CONTROL_ECU already has a password, kept
+ * from before a reset of either ECU. Only OP_CHANGE_PW replaces it.
+ * VERDICT_NO_PW: OP_OPEN or OP_CHANGE_PW before the first password is set,
+ * OP_SET_PW must come first.
+ */
+typedef enum {
+	VERDICT_INVALID, VERDICT_VALID, VERDICT_LOCKOUT, VERDICT_BUSY, VERDICT_ERROR,
+	VERDICT_PW_SET, VERDICT_NO_PW
+} PROTOCOL_verdict;
+
+typedef struct {
+	uint8 type;
+	uint8 length;
+	uint8 payload[PROTOCOL_MAX_PAYLOAD];
+} PROTOCOL_frame;
+
+/* Health of the link: UART receive errors plus frame level counters */
+typedef struct {
+	UART_error_counters uart;
+	uint16 frames_received; /* frames with a matching CRC */
+	uint16 frames_rejected; /* frames dropped for a bad length or CRC */
+	uint16 retries; /* requests sent again after a timeout or receive error */
+} PROTOCOL_link_statistics;
+
+typedef enum {
+	WAIT_SOF, WAIT_TYPE, WAIT_LENGTH, WAIT_PAYLOAD, WAIT_CRC_HIGH, WAIT_CRC_LOW
+} PROTOCOL_parser_state;
+
+typedef struct {
+	PROTOCOL_parser_state state;
+	uint8 index;
+	uint16 crc;
+	uint16 received_crc;
+	boolean escaped; /* the last byte was PROTOCOL_ESC */
+	PROTOCOL_frame frame;
+} PROTOCOL_parser;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Update a running CRC-16/CCITT with one byte using the lookup table.
+ */
+uint16 PROTOCOL_crc16(uint16 crc, uint8 data);
+
+/*
+ * Description :
+ * Build a frame around the payload and queue it on the UART.
+ */
+void PROTOCOL_sendFrame(uint8 type, const uint8 *payload, uint8 length);
+
+/*
+ * Description :
+ * Reset the parser so it hunts for the next start of frame.
+ */
+void PROTOCOL_parserInit(PROTOCOL_parser *parser);
+
+/*
+ * Description :
+ * Feed one received byte to the parser.
+ * Return TRUE when a complete frame with a matching CRC is in parser->frame.
+ */
+boolean PROTOCOL_parseByte(PROTOCOL_parser *parser, uint8 data);
+
+/*
+ * Description :
+ * Wait at most timeout_ms (1 ms Timer0 tick) for a valid frame and copy it
+ * to frame. Return UART_OK, UART_TIMEOUT, or the UART receive error that
+ * broke the frame in progress (the caller may retry right away).
+ */
+UART_status PROTOCOL_receiveFrame(PROTOCOL_frame *frame, uint16 timeout_ms);
+
+/*
+ * Description :
+ * Feed the bytes already received to the parser without waiting.
+ * Return TRUE and copy the frame as soon as one is complete, the bytes after
+ * it stay in the Rx buffer for the next call. A UART receive error drops the
+ * frame in progress.
+ */
+boolean PROTOCOL_pollFrame(PROTOCOL_frame *frame);
+
+/*
+ * Description :
+ * Count a request sent again because the previous one got no answer.
+ */
+void PROTOCOL_countRetry(void);
+
+/*
+ * Description :
+ * Copy the link health counters.
+ */
+void PROTOCOL_getLinkStatistics(PROTOCOL_link_statistics *stats);
+
+/*
+ * Description :
+ * Reset the link health counters, including the UART error counters.
+ */
+void PROTOCOL_clearLinkStatistics(void);
+
+#endif /* PROTOCOL_H_ */
@@ -0,0 +1,124 @@
+/******************************************************************************
+ *
+ * Module: SPSC
+ *
+ * File Name: spsc.h
+ *
+ * Description: Header only single-producer/single-consumer ring buffers
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef SPSC_H_
+#define SPSC_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * SPSC_QUEUE(name, type, capacity) defines the queue type name and its
+ * functions name_init, name_push, name_pop, name_peek, name_count and
+ * name_highWater, for items of any type (a byte, a record struct).
+ *
+ * One producer and one consumer, each may be an ISR or the main loop, and
+ * neither ever disables the interrupts:
+ * - head is written by the producer only and tail by the consumer only,
+ *   both are single bytes so the AVR reads and writes them atomically.
+ * - Both count up freely and wrap at 256, head - tail is the item count so
+ *   all the capacity slots are usable.
+ * - The producer stores the item before it publishes the new head, and the
+ *   consumer copies the item out before it frees the slot with the new tail.
+ *   SPSC_BARRIER keeps the compiler from reordering the item copies around
+ *   the index updates, the AVR itself never reorders memory accesses.
+ *
+ * capacity must be a power of two up to 128, checked at compile time.
+ * name_init must run before the producer and the consumer start.
+ */
+
+/* Compiler barrier, the item copies stay on their side of the index update */
+#define SPSC_BARRIER()					__asm__ __volatile__ ("" ::: "memory")
+
+#define SPSC_QUEUE(name, type, capacity)									\
+																			\
+typedef char name##_capacity_check[											\
+		(((capacity) & ((capacity) - 1)) == 0) && ((capacity) != 0)			\
+		&& ((capacity) <= 128) ? 1 : -1];									\
+																			\
+typedef struct {															\
+	type items[capacity];													\
+	volatile uint8 head; /* Written by the producer only */					\
+	volatile uint8 tail; /* Written by the consumer only */					\
+	volatile uint8 high_water; /* Most items ever queued, producer only */	\
+} name;																		\
+																			\
+static inline void name##_init(name *queue) {								\
+	queue->head = 0;														\
+	queue->tail = 0;														\
+	queue->high_water = 0;													\
+}																			\
+																			\
+/* Items waiting, a snapshot if called by neither side */					\
+static inline uint8 name##_count(const name *queue) {						\
+	return (uint8) (queue->head - queue->tail);								\
+}																			\
+																			\
+/* Producer: queue a copy of the item, FALSE if the queue is full */		\
+static inline boolean name##_push(name *queue, type const *item) {			\
+	uint8 head = queue->head;												\
+	uint8 count = (uint8) (head - queue->tail);								\
+																			\
+	if (count == (capacity)) {												\
+		return FALSE;														\
+	}																		\
+	queue->items[head & ((capacity) - 1)] = *item;							\
+	SPSC_BARRIER();															\
+	queue->head = head + 1;													\
+																			\
+	count++;																\
+	if (count > queue->high_water) {										\
+		queue->high_water = count;											\
+	}																		\
+	return TRUE;															\
+}																			\
+																			\
+/* Consumer: copy the oldest item without taking it, FALSE if empty */		\
+static inline boolean name##_peek(const name *queue, type *item) {			\
+	uint8 tail = queue->tail;												\
+																			\
+	if (tail == queue->head) {												\
+		return FALSE;														\
+	}																		\
+	SPSC_BARRIER();															\
+	*item = queue->items[tail & ((capacity) - 1)];							\
+	return TRUE;															\
+}																			\
+																			\
+/* Consumer: take the oldest item, FALSE if the queue is empty */			\
+static inline boolean name##_pop(name *queue, type *item) {					\
+	if (name##_peek(queue, item) == FALSE) {								\
+		return FALSE;														\
+	}																		\
+	SPSC_BARRIER();															\
+	queue->tail++;															\
+	return TRUE;															\
+}																			\
+																			\
+/* Items ever pushed and popped, modulo 256: positions in the stream */	\
+static inline uint8 name##_pushed(const name *queue) {						\
+	return queue->head;														\
+}																			\
+																			\
+static inline uint8 name##_popped(const name *queue) {						\
+	return queue->tail;														\
+}																			\
+																			\
+/* Most items ever waiting at the same time, to size the capacity */		\
+static inline uint8 name##_highWater(const name *queue) {					\
+	return queue->high_water;												\
+}
+
+#endif /* SPSC_H_ */
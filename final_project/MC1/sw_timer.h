@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * Module: SW_TIMER
+ *
+ * File Name: sw_timer.h
+ *
+ * Description: Header file for the software timer service driven by Timer0
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef SW_TIMER_H_
+#define SW_TIMER_H_
+
+#include "std_types.h"
+#include "timer.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Number of timers that can run at the same time */
+#define SW_TIMER_MAX					8
+
+/*
+ * Slots of the hashed timing wheel, must be a power of two. A slot is kept in
+ * expiry order, so a tick only looks at the timers expiring in it plus one.
+ * Starting a timer (and re-arming a periodic one in the tick) walks the
+ * timers hashed to its slot, at most SW_TIMER_MAX of them.
+ */
+#define SW_TIMER_WHEEL_SIZE				16
+
+#if (SW_TIMER_WHEEL_SIZE & (SW_TIMER_WHEEL_SIZE - 1))
+#error "SW_TIMER_WHEEL_SIZE must be a power of two"
+#endif
+
+/* Returned by SWTIMER_start when all the timers are busy */
+#define SW_TIMER_INVALID				0xFF
+
+/* Timer ticks in seconds, the tick is the 1 ms Timer0 compare match */
+#define SW_TIMER_SECONDS(s)				((uint32) (s) * 1000UL)
+
+typedef uint8 SW_timer_id;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Stop all the timers and hook the service to the Timer0 compare interrupt.
+ * Timer0 itself is started by Timer_Init as the 1 ms tick.
+ */
+void SWTIMER_init(void);
+
+/*
+ * Description :
+ * Start a timer that calls callback after ticks ticks (at least 1), then
+ * every period ticks, or only once if period is 0.
+ * The callback runs in the Timer0 interrupt so it must be short.
+ * Return the timer id or SW_TIMER_INVALID if no timer is free.
+ */
+SW_timer_id SWTIMER_start(uint32 ticks, uint32 period, void (*callback)(void));
+
+/*
+ * Description :
+ * Stop a running timer, its callback will not be called anymore.
+ */
+void SWTIMER_cancel(SW_timer_id id);
+
+/*
+ * Description :
+ * Advance the wheel by one tick, called from the Timer0 compare interrupt.
+ */
+void SWTIMER_tick(void);
+
+#endif /* SW_TIMER_H_ */
@@ -9,101 +9,243 @@
 #include "timer.h"
 #include "std_types.h"
 
-/* Defined static to be file scoped, and volatile because it is called in ISR  */
-static volatile void (*timer0_ovf_ptr)(void) = NULL; /*pointer to timer0 overflow function*/
-static volatile void (*timer0_comp_ptr)(void) = NULL; /*pointer to timer0 compare function*/
-static volatile void (*timer1_ovf_ptr)(void) = NULL; /*pointer to timer1 overflow function*/
-static volatile void (*timer1_compa_ptr)(void) = NULL; /*pointer to timer1 compare a function*/
-static volatile void (*timer1_compb_ptr)(void) = NULL; /*pointer to timer1 compare b function*/
-static volatile void (*timer2_ovf_ptr)(void) = NULL; /*pointer to timer2 overflow function*/
-static volatile void (*timer2_comp_ptr)(void) = NULL; /*pointer to timer0 compare function*/
+/* Subscribers of each timer interrupt vector, slots freed by
+ * Timer_unsubscribe are reused and skipped by the dispatcher */
+static timer_subscriber g_subscribers[TIMER_VECTORS][TIMER_MAX_SUBSCRIBERS];
 
-/***********************************************************ISR*************************************************************/
+/* Used slots of each vector (highest used slot + 1), bounds the dispatch loop */
+static uint8 g_subscriberCount[TIMER_VECTORS];
 
-ISR(TIMER0_OVF_vect) {
+#if TIMER_PROFILE
+/* Longest run of each subscriber in CPU cycles, see Timer_getMaxCycles */
+static uint16 g_maxCycles[TIMER_VECTORS][TIMER_MAX_SUBSCRIBERS];
+#endif
+
+/* Milliseconds counted by the Timer0 compare match tick, read it through Timer_millis */
+static volatile uint32 g_millis = 0;
+
+/* CS22:0 of each timer_prescalar, Timer2 inserts /32 and /128 in its table */
+static const uint8 timer2_clock_select[] = { 0, 1, 2, 4, 6, 7 };
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Run the subscribers of one vector whose divider count is reached,
+ * called from the ISRs with interrupts disabled.
+ */
+static void Timer_dispatch(timer_vector vector) {
+	uint8 slot;
+	timer_subscriber *subscriber = g_subscribers[vector];
 
-	if (timer0_ovf_ptr != NULL) {
-		(*timer0_ovf_ptr)();
+	for (slot = 0; slot < g_subscriberCount[vector]; slot++, subscriber++) {
+		if ((subscriber->callback == NULL) || (--subscriber->countdown != 0)) {
+			continue;
+		}
+		subscriber->countdown = subscriber->divider;
+
+#if TIMER_PROFILE
+		{
+			uint8 start = TCNT0;
+			uint16 cycles;
+
+			subscriber->callback();
+
+			cycles = Timer_cyclesSince(start);
+			if (cycles > g_maxCycles[vector][slot]) {
+				g_maxCycles[vector][slot] = cycles;
+			}
+		}
+#else
+		subscriber->callback();
+#endif
 	}
 }
 
+/***********************************************************ISR*************************************************************/
+
+ISR(TIMER0_OVF_vect) {
+	Timer_dispatch(TIMER0_OVF);
+}
+
 ISR(TIMER0_COMP_vect) {
 
-	if (timer0_comp_ptr != NULL) {
-		(*timer0_comp_ptr)();
-	}
+	/* 1 ms time base shared by the drivers (UART timeouts, software timers) */
+	g_millis++;
+
+	Timer_dispatch(TIMER0_COMP);
 }
 
 ISR(TIMER1_OVF_vect) {
-
-	if (timer1_ovf_ptr != NULL) {
-		(*timer1_ovf_ptr)();
-	}
+	Timer_dispatch(TIMER1_OVF);
 }
 
 /*timer1 compare a ISR*/
 ISR(TIMER1_COMPA_vect) {
-	if (timer1_compa_ptr != NULL) {
-		(*timer1_compa_ptr)();
-	}
+	Timer_dispatch(TIMER1_COMPA);
 }
 
 /*timer1 compare b ISR*/
 ISR(TIMER1_COMPB_vect) {
-	if (timer1_compb_ptr != NULL) {
-		(*timer1_compb_ptr)();
-	}
+	Timer_dispatch(TIMER1_COMPB);
 }
 
 /*timer2 overflow ISR*/
 ISR(TIMER2_OVF_vect) {
-	if (timer2_ovf_ptr != NULL) {
-		(*timer2_ovf_ptr)();
-	}
+	Timer_dispatch(TIMER2_OVF);
 }
 
 /*timer2 compare ISR*/
 ISR(TIMER2_COMP_vect) {
-	if (timer2_comp_ptr != NULL) {
-		(*timer2_comp_ptr)();
-	}
+	Timer_dispatch(TIMER2_COMP);
 }
 
-/***************************************************Call Back Functions For ISR***************************************************/
+/***************************************************Call Back Subscription***************************************************/
+
+timer_subscriber_id Timer_subscribe(timer_vector vector, void (*a_ptr)(void),
+		uint8 divider) {
+	uint8 slot;
+	timer_subscriber_id id = TIMER_NO_SUBSCRIBER;
+	uint8 sreg = SREG;
+
+	if ((vector >= TIMER_VECTORS) || (a_ptr == NULL)) {
+		return TIMER_NO_SUBSCRIBER;
+	}
+
+	if (divider == 0) {
+		divider = 1;
+	}
+
+	/* The table is walked by the ISR, update it with interrupts off */
+	cli();
+	for (slot = 0; slot < TIMER_MAX_SUBSCRIBERS; slot++) {
+		if (g_subscribers[vector][slot].callback == NULL) {
+			g_subscribers[vector][slot].divider = divider;
+			g_subscribers[vector][slot].countdown = divider;
+			g_subscribers[vector][slot].callback = a_ptr;
+#if TIMER_PROFILE
+			g_maxCycles[vector][slot] = 0;
+#endif
+			if (slot >= g_subscriberCount[vector]) {
+				g_subscriberCount[vector] = slot + 1;
+			}
+			id = (timer_subscriber_id) ((vector * TIMER_MAX_SUBSCRIBERS) + slot);
+			break;
+		}
+	}
+	SREG = sreg;
 
-/*timer0 overflow Call Back Function*/
-void TIMER0_OVF_interrupt(void (*a_ptr)(void)) {
-	timer0_ovf_ptr = a_ptr;
+	return id;
 }
 
-/*timer0 compare Call Back Function*/
-void TIMER0_COMP_interrupt(void (*a_ptr)(void)) {
-	timer0_comp_ptr = a_ptr;
+void Timer_unsubscribe(timer_subscriber_id id) {
+	uint8 vector = id / TIMER_MAX_SUBSCRIBERS;
+	uint8 slot = id % TIMER_MAX_SUBSCRIBERS;
+	uint8 sreg = SREG;
+
+	if (vector >= TIMER_VECTORS) {
+		return;
+	}
+
+	cli();
+	g_subscribers[vector][slot].callback = NULL;
+
+	/* Shrink the dispatch loop over the free slots at the end */
+	while ((g_subscriberCount[vector] != 0)
+			&& (g_subscribers[vector][g_subscriberCount[vector] - 1].callback
+					== NULL)) {
+		g_subscriberCount[vector]--;
+	}
+	SREG = sreg;
 }
 
-/*timer1 overflow Call Back Function*/
-void TIMER1_OVF_interrupt(void (*a_ptr)(void)) {
-	timer1_ovf_ptr = a_ptr;
+uint16 Timer_getMaxCycles(timer_subscriber_id id) {
+#if TIMER_PROFILE
+	uint16 cycles;
+	uint8 sreg = SREG;
+
+	if (id >= (TIMER_VECTORS * TIMER_MAX_SUBSCRIBERS)) {
+		return 0;
+	}
+
+	cli();
+	cycles = g_maxCycles[id / TIMER_MAX_SUBSCRIBERS][id % TIMER_MAX_SUBSCRIBERS];
+	SREG = sreg;
+
+	return cycles;
+#else
+	(void) id;
+	return 0;
+#endif
 }
 
-/*timer1 compare A Call Back Function*/
-void TIMER1_COMPA_interrupt(void (*a_ptr)(void)) {
-	timer1_compa_ptr = a_ptr;
+void Timer_clearMaxCycles(void) {
+#if TIMER_PROFILE
+	uint8 vector;
+	uint8 slot;
+	uint8 sreg = SREG;
+
+	cli();
+	for (vector = 0; vector < TIMER_VECTORS; vector++) {
+		for (slot = 0; slot < TIMER_MAX_SUBSCRIBERS; slot++) {
+			g_maxCycles[vector][slot] = 0;
+		}
+	}
+	SREG = sreg;
+#endif
 }
 
-/*timer1 compare B Call Back Function*/
-void TIMER1_COMPB_interrupt(void (*a_ptr)(void)) {
-	timer1_compb_ptr = a_ptr;
+/***************************************************************Timer_millis***************************************************************************/
+
+uint32 Timer_millis(void) {
+	uint32 ms;
+	uint8 sreg = SREG;
+
+	/* The 32-bit counter is updated by the ISR one byte at a time,
+	 * copy it with interrupts off so the read can not tear */
+	cli();
+	ms = g_millis;
+	SREG = sreg;
+
+	return ms;
 }
 
-/*timer2 overflow Call Back Function*/
-void TIMER2_OVF_interrupt(void (*a_ptr)(void)) {
-	timer2_ovf_ptr = a_ptr;
+/***************************************************************Timer_micros***************************************************************************/
+
+uint32 Timer_micros(void) {
+	uint32 ms;
+	uint8 count;
+	uint8 sreg = SREG;
+
+	cli();
+	ms = g_millis;
+	count = TCNT0;
+
+	/* TCNT0 already wrapped but the ISR did not run yet, count that millisecond */
+	if (BIT_IS_SET(TIFR, OCF0) && (count < (uint8) TIMER0_TICK_COMPARE)) {
+		ms++;
+	}
+	SREG = sreg;
+
+	return (ms * 1000UL) + ((uint32) count * (uint32) TIMER0_TICK_US_PER_COUNT);
 }
 
-/*timer02 compare Call Back Function*/
-void TIMER2_COMP_interrupt(void (*a_ptr)(void)) {
-	timer2_comp_ptr = a_ptr;
+/***************************************************************Timer_cyclesSince**********************************************************************/
+
+uint16 Timer_cyclesSince(uint8 start) {
+	uint8 now = TCNT0;
+	uint8 counts;
+
+	if (now >= start) {
+		counts = now - start;
+	} else {
+		/* TCNT0 restarted from 0 after the compare match */
+		counts = (uint8) (now + (uint8) TIMER0_TICK_COMPARE + 1 - start);
+	}
+
+	return (uint16) counts * (uint16) TIMER0_TICK_DIVIDER;
 }
 
 /***************************************************************Timer_Init***************************************************************************/
@@ -116,7 +258,7 @@ void Timer_Init(const timer_configuration *config_ptr) {
 	if ((*config_ptr).number == TIMER0) {
 
 		/* Initial Value */
-		TCNT0 = Timer0_initial_value;
+		TCNT0 = (uint8) config_ptr->initial_value;
 
 		/* The FOC0 bit is only active when the WGM00 bit specifies a non-PWM mode. */
 		TCCR0 = (1 << FOC0);
@@ -130,7 +272,7 @@ void Timer_Init(const timer_configuration *config_ptr) {
 			TCCR0 = (TCCR0 & 0xB7) | ((config_ptr->mode) << 3);
 
 			/* Set compare value */
-			OCR0 = Timer0_initial_value;
+			OCR0 = (uint8) config_ptr->compare_value;
 
 			/* Bit 1  OCIE0: Timer/Counter0 Output Compare Match Interrupt Enable */
 			TIMSK = (1 << OCIE0);
@@ -146,10 +288,10 @@ void Timer_Init(const timer_configuration *config_ptr) {
 			TCCR0 &= ~(1 << COM00) & ~(1 << COM01); /* Normal mode */
 
 		}
-	} else if ((*config_ptr).mode == TIMER1) {
+	} else if ((*config_ptr).number == TIMER1) {
 
 		/* Initial Value */
-		TCNT1 = Timer1_initial_value;
+		TCNT1 = config_ptr->initial_value;
 
 		/* The FOC0 bit is only active when the WGM00 bit specifies a non-PWM mode. */
 		TCCR1A = (1 << FOC1A);
@@ -163,7 +305,7 @@ void Timer_Init(const timer_configuration *config_ptr) {
 			TCCR1B = (TCCR1B & 0xE7) | ((config_ptr->mode) << 3);
 
 			/* Set compare value */
-			OCR1A = Timer1_compare_value;
+			OCR1A = config_ptr->compare_value;
 
 			/*  Bit 4  OCIE1A: Timer/Counter1, Output Compare A Match Interrupt Enable */
 			TIMSK = (1 << OCIE1A);
@@ -187,13 +329,13 @@ void Timer_Init(const timer_configuration *config_ptr) {
 	} else if ((*config_ptr).number == TIMER2) {
 
 		/* Initial Value */
-		TCNT2 = Timer2_initial_value;
+		TCNT2 = (uint8) config_ptr->initial_value;
 
 		/*  Bit 7  FOC2: Force Output Compare */
 		TCCR2 = (1 << FOC2);
 
-		/*  Bit 2:0  CS22:0: Clock Select */
-		TCCR2 = (TCCR2 & 0xF8) | (config_ptr->clock);
+		/*  Bit 2:0  CS22:0: Clock Select, Timer2 has its own encoding (/32, /128) */
+		TCCR2 = (TCCR2 & 0xF8) | timer2_clock_select[config_ptr->clock];
 
 		if ((*config_ptr).mode == CTC_MODE) {
 
@@ -201,7 +343,7 @@ void Timer_Init(const timer_configuration *config_ptr) {
 			TCCR2 = (TCCR2 & 0xB7) | ((config_ptr->mode) << 3);
 
 			/* Set compare value */
-			OCR2 = Timer2_compare_value;
+			OCR2 = (uint8) config_ptr->compare_value;
 
 			/*  Bit 7  OCIE2: Timer/Counter2 Output Compare Match Interrupt Enable */
 			TIMSK = (1 << OCIE2);
@@ -16,46 +16,95 @@
  * 											Definitions													*
  *******************************************************************************************************/
 
-/* Timer/Counter Register  TCNT0 */
-
-#define Timer0_initial_value				0
-#define Timer1_initial_value				0
-#define Timer2_initial_value				0
-
-#define Timer0_compare_value 				50
-#define Timer1_compare_value 				50
-#define Timer2_compare_value 				50
-
-/* F_CPU = 1MHz
- * Prescalar (N) = 256
- * F_timer = (F_CPU / N)
- * T_timer0 = 1 / F_timer0
- * T_overflow = 256 * T_timer0
- * No. of overflows per second = 1 / T_overflow = 15.25 overflows/second
- */
-#define NUMBER_OF_OVERFLOWS_PER_SECOND_T0	15.25
-
-/* F_CPU = 1MHz
- * Prescalar (N) = 256
- * F_timer1 = (F_CPU / N)
- * T_timer1 = 1 / F_timer1
- * T_overflow = 1024 * T_timer1
- * No. of overflows per second = 1 / T_overflow = 3.81 overflows/second
+/*
+ * Compile-time timer configuration from a period in microseconds.
+ * TIMER_DIVIDER picks the smallest prescaler whose count range (top = 256
+ * counts for Timer0/2, 65536 for Timer1) holds the period, which gives the
+ * finest resolution. All the arithmetic is integer so it is folded by the
+ * compiler and can be checked by #if, e.g.:
+ *
+ * #if !TIMER_PERIOD_OK(2000UL, TIMER_TOP_8BIT)
+ * #error "2 ms can not be made with an 8-bit timer"
+ * #endif
+ * timer_configuration T2 = { CTC_MODE,
+ *		TIMER_PRESCALER(TIMER_DIVIDER(2000UL, TIMER_TOP_8BIT)), TIMER2,
+ *		TIMER_COMPARE(2000UL, TIMER_TOP_8BIT), 0 };
  */
-#define NUMBER_OF_OVERFLOWS_PER_SECOND_T1	3.81
-
-/* F_CPU = 1MHz
- * Prescalar (N) = 256
- * F_timer2 = (F_CPU / N)
- * T_timer2 = 1 / F_timer
- * T2_overflow = 256 * T_timer2
- * No. of overflows per second = 1 / T_overflow = 3.81 overflows/second
+#define TIMER_TOP_8BIT						256ULL
+#define TIMER_TOP_16BIT						65536ULL
+
+/* Allowed difference between the asked and the produced period */
+#define TIMER_ERROR_LIMIT_PPM				1000ULL
+
+/* Timer counts in period_us with the given prescaler divider, rounded */
+#define TIMER_COUNTS(period_us, divider)	\
+	(((period_us) * 1ULL * F_CPU / (divider) + 500000ULL) / 1000000ULL)
+
+#define TIMER_DIVIDER(period_us, top)	\
+	((TIMER_COUNTS(period_us, 1ULL) <= (top)) ? 1ULL :		\
+	 (TIMER_COUNTS(period_us, 8ULL) <= (top)) ? 8ULL :		\
+	 (TIMER_COUNTS(period_us, 64ULL) <= (top)) ? 64ULL :	\
+	 (TIMER_COUNTS(period_us, 256ULL) <= (top)) ? 256ULL : 1024ULL)
+
+/* timer_prescalar value of a divider picked by TIMER_DIVIDER */
+#define TIMER_PRESCALER(divider)	\
+	(((divider) == 1ULL) ? NO_PRESCALING : ((divider) == 8ULL) ? F_CPU_8 :		\
+	 ((divider) == 64ULL) ? F_CPU_64 : ((divider) == 256ULL) ? F_CPU_256 : F_CPU_1024)
+
+/* OCRx value of a CTC period, the timer counts OCRx + 1 steps per period */
+#define TIMER_COMPARE(period_us, top)	\
+	(TIMER_COUNTS(period_us, TIMER_DIVIDER(period_us, top)) - 1)
+
+/* Whole overflows of a NORMAL_MODE timer in period_us, rounded */
+#define TIMER_OVERFLOWS(period_us, divider, top)	\
+	(((period_us) * 1ULL * F_CPU / (divider) + (top) * 500000ULL) / ((top) * 1000000ULL))
+
+/* Period really produced in CTC mode, in nanoseconds */
+#define TIMER_ACTUAL_NS(period_us, top)	\
+	(TIMER_COUNTS(period_us, TIMER_DIVIDER(period_us, top))		\
+	 * TIMER_DIVIDER(period_us, top) * 1000000000ULL / F_CPU)
+
+#define TIMER_ERROR_PPM(period_us, top)	\
+	(((TIMER_ACTUAL_NS(period_us, top) > (period_us) * 1000ULL) ?		\
+	  (TIMER_ACTUAL_NS(period_us, top) - (period_us) * 1000ULL) :		\
+	  ((period_us) * 1000ULL - TIMER_ACTUAL_NS(period_us, top))) * 1000ULL / (period_us))
+
+/* The period fits the timer and is within TIMER_ERROR_LIMIT_PPM */
+#define TIMER_PERIOD_OK(period_us, top)	\
+	((TIMER_COUNTS(period_us, TIMER_DIVIDER(period_us, top)) >= 1ULL)	\
+	 && (TIMER_COUNTS(period_us, TIMER_DIVIDER(period_us, top)) <= (top))	\
+	 && (TIMER_ERROR_PPM(period_us, top) <= TIMER_ERROR_LIMIT_PPM))
+
+/* Callbacks that can share one timer interrupt vector */
+#ifndef TIMER_MAX_SUBSCRIBERS
+#define TIMER_MAX_SUBSCRIBERS				4
+#endif
+
+#define TIMER_NO_SUBSCRIBER					0xFF
+
+/* Measure the longest run of every subscriber, costs about 30 cycles per call */
+#ifndef TIMER_PROFILE
+#define TIMER_PROFILE						0
+#endif
+
+/*
+ * Timer0 1 ms system tick in CTC mode, used by both ECUs.
+ * At 1 MHz: /8 prescaler, 125 counts of 8 us, OCR0 = 124, 1 ms exactly
  */
-#define NUMBER_OF_OVERFLOWS_PER_SECOND_T2	15.25
+#define TIMER0_TICK_PERIOD_US				1000ULL
+#define TIMER0_TICK_DIVIDER					TIMER_DIVIDER(TIMER0_TICK_PERIOD_US, TIMER_TOP_8BIT)
+#define TIMER0_TICK_PRESCALER				TIMER_PRESCALER(TIMER0_TICK_DIVIDER)
+#define TIMER0_TICK_COMPARE					TIMER_COMPARE(TIMER0_TICK_PERIOD_US, TIMER_TOP_8BIT)
+#define TIMER0_TICK_US_PER_COUNT			((TIMER0_TICK_DIVIDER * 1000000ULL) / F_CPU)
 
-extern volatile uint32 SECONDS_T1;
-extern volatile uint32 SECONDS_T0_MC1;
-extern volatile uint32 SECONDS_T0_MC2;
+#if !TIMER_PERIOD_OK(TIMER0_TICK_PERIOD_US, TIMER_TOP_8BIT)
+#error "F_CPU does not give a 1 ms Timer0 tick within TIMER_ERROR_LIMIT_PPM"
+#endif
+
+/* Timer_micros steps by whole microseconds per count */
+#if ((TIMER0_TICK_DIVIDER * 1000000ULL) % F_CPU) != 0
+#error "A Timer0 tick count is not a whole number of microseconds at this F_CPU"
+#endif
 
 typedef enum {
 	NO_CLOCK, NO_PRESCALING, F_CPU_8, F_CPU_64, F_CPU_256, F_CPU_1024
@@ -81,6 +130,22 @@ typedef struct {
 	timer_number timerNumber;
 } timer_deInt;
 
+/* Interrupt vectors that can be subscribed to with Timer_subscribe */
+typedef enum {
+	TIMER0_OVF, TIMER0_COMP, TIMER1_OVF, TIMER1_COMPA, TIMER1_COMPB,
+	TIMER2_OVF, TIMER2_COMP, TIMER_VECTORS
+} timer_vector;
+
+/* One entry of a vector dispatch table */
+typedef struct {
+	void (*callback)(void);
+	uint8 divider;		/* Run the callback every divider interrupts */
+	uint8 countdown;	/* Interrupts left before the next run */
+} timer_subscriber;
+
+/* Handle returned by Timer_subscribe, vector * TIMER_MAX_SUBSCRIBERS + slot */
+typedef uint8 timer_subscriber_id;
+
 /********************************************************************************************************
  * 											Prototypes												    *
  *******************************************************************************************************/
@@ -104,12 +169,75 @@ void Timer_Init(const timer_configuration *config_ptr);
 void Timer_deInit(const timer_deInt *deInt_ptr);
 
 /*
- * Name: Timer0_setCallBack
- * Description: Call back function.
- * Input: pointer to function
+ * Name: Timer_subscribe
+ * Description: Add a call back function to a timer interrupt vector, it is
+ * called from the ISR every divider interrupts (0 is taken as 1). Up to
+ * TIMER_MAX_SUBSCRIBERS modules can share one vector, in subscription order.
+ * Input: vector, pointer to function, divider
+ * Return: timer_subscriber_id, TIMER_NO_SUBSCRIBER if the vector is full
+ */
+
+timer_subscriber_id Timer_subscribe(timer_vector vector, void (*a_ptr)(void),
+		uint8 divider);
+
+/*
+ * Name: Timer_unsubscribe
+ * Description: Remove a call back function added by Timer_subscribe.
+ * Input: timer_subscriber_id
+ * Return: None
+ */
+
+void Timer_unsubscribe(timer_subscriber_id id);
+
+/*
+ * Name: Timer_getMaxCycles
+ * Description: Longest run of a subscriber in CPU cycles since it was added
+ * or since Timer_clearMaxCycles, measured on TCNT0 so the resolution is
+ * TIMER0_TICK_DIVIDER cycles. Always 0 unless TIMER_PROFILE is set.
+ * Input: timer_subscriber_id
+ * Return: uint16
+ */
+
+uint16 Timer_getMaxCycles(timer_subscriber_id id);
+
+/*
+ * Name: Timer_clearMaxCycles
+ * Description: Restart the cycle measurement of all the subscribers.
+ * Input: None
  * Return: None
  */
 
-void Timer0_setCallBack(void (*a_ptr)(void));
+void Timer_clearMaxCycles(void);
+
+/*
+ * Name: Timer_millis
+ * Description: Milliseconds since Timer0 was started as the 1 ms tick
+ * (CTC_MODE, TIMER0_TICK_PRESCALER, TIMER0_TICK_COMPARE), read atomically.
+ * Input: None
+ * Return: uint32, wraps after 49.7 days so compare differences only
+ */
+
+uint32 Timer_millis(void);
+
+/*
+ * Name: Timer_micros
+ * Description: Microseconds since Timer0 was started as the 1 ms tick,
+ * the sub-millisecond part comes from TCNT0 (TIMER0_TICK_US_PER_COUNT steps).
+ * Input: None
+ * Return: uint32, wraps after 71.6 minutes so compare differences only
+ */
+
+uint32 Timer_micros(void);
+
+/*
+ * Name: Timer_cyclesSince
+ * Description: CPU cycles since TCNT0 read start, for measuring short code
+ * paths. Timer0 must run as the 1 ms tick and the measured code must take
+ * less than one tick, the resolution is TIMER0_TICK_DIVIDER cycles.
+ * Input: TCNT0 value read at the start
+ * Return: uint16
+ */
+
+uint16 Timer_cyclesSince(uint8 start);
 
 #endif /* TIMER_H_ */
@@ -14,6 +14,140 @@
 #include "avr/io.h" /* To use the UART Registers */
 #include "common_macros.h" /* To use the macros like SET_BIT */
 #include "gpio.h"
+#include "micro_config.h" /* To use the ISR macro */
+#include "timer.h" /* Timer0 time base for the receive timeouts */
+#include "idle.h" /* Sleep while waiting for received bytes */
+#include "spsc.h" /* Lock-free buffers shared with the ISRs */
+
+/*******************************************************************************
+ *                      Global Variables (Private)                             *
+ *******************************************************************************/
+
+/*
+ * Ring buffers shared with the ISRs without disabling the interrupts:
+ * the USART_RXC ISR produces the Rx bytes and the application consumes them,
+ * the application produces the Tx bytes and the USART_UDRE ISR consumes them.
+ */
+SPSC_QUEUE(UART_rx_queue, uint8, UART_RX_BUFFER_SIZE)
+SPSC_QUEUE(UART_tx_queue, uint8, UART_TX_BUFFER_SIZE)
+
+static UART_rx_queue g_rxQueue;
+
+/* Own address in multidrop mode, UART_NO_ADDRESS when not on a bus */
+static volatile uint8 g_nodeAddress = UART_NO_ADDRESS;
+
+/* Receive error counters, written by the Rx ISR only */
+static volatile UART_error_counters g_errorCounters = { 0, 0, 0, 0 };
+
+/*
+ * First receive error latched by the Rx ISR, cleared when it is reported, and
+ * its place in the Rx stream: the bytes pushed before it. The bytes received
+ * before the error are read first, the error is reported when they are gone.
+ */
+static volatile UART_status g_rxStatus = UART_OK;
+static volatile uint8 g_rxErrorAt;
+
+/* Called by the Rx ISR after each byte put in the Rx buffer, NULL for none */
+static void (*volatile g_rxCallBack)(void) = NULL;
+
+static UART_tx_queue g_txQueue;
+
+/*******************************************************************************
+ *                      Interrupt Service Routines                             *
+ *******************************************************************************/
+
+/* A byte has been received, move it from UDR to the Rx buffer */
+ISR(USART_RXC_vect) {
+	/* The error flags and the 9th bit belong to the byte in UDR, read them first */
+	uint8 status = UCSRA;
+	uint8 ninth_bit = BIT_IS_SET(UCSRB, RXB8);
+	uint8 data = UDR;
+	UART_status error = UART_OK;
+
+	/* Bit 3 - DOR: a byte was lost before this one, this one is still good */
+	if (BIT_IS_SET(status, DOR)) {
+		g_errorCounters.overrun_errors++;
+		error = UART_OVERFLOW;
+	}
+
+	/* Bytes with a framing or parity error are never handed to the application */
+	if (BIT_IS_SET(status, FE)) {
+		g_errorCounters.framing_errors++;
+		error = UART_FRAME_ERROR;
+	} else if (BIT_IS_SET(status, PE)) {
+		g_errorCounters.parity_errors++;
+		error = UART_PARITY_ERROR;
+	}
+
+	if ((error != UART_OK) && (g_rxStatus == UART_OK)) {
+		g_rxErrorAt = UART_rx_queue_pushed(&g_rxQueue);
+		g_rxStatus = error;
+	}
+	if ((error == UART_FRAME_ERROR) || (error == UART_PARITY_ERROR)) {
+		return;
+	}
+
+	/*
+	 * Multidrop address frame (9th bit set): stay awake for data frames only
+	 * if it carries our address. With MPCM set the hardware drops data frames
+	 * without raising this interrupt at all.
+	 */
+	if ((g_nodeAddress != UART_NO_ADDRESS) && ninth_bit) {
+		if (data == g_nodeAddress) {
+			CLEAR_BIT(UCSRA, MPCM);
+		} else {
+			SET_BIT(UCSRA, MPCM);
+		}
+		return;
+	}
+
+	/* Drop the byte if the application did not keep up and the buffer is full */
+	if (UART_rx_queue_push(&g_rxQueue, &data) == TRUE) {
+		if (g_rxCallBack != NULL) {
+			(*g_rxCallBack)();
+		}
+	} else {
+		g_errorCounters.buffer_overflows++;
+		if (g_rxStatus == UART_OK) {
+			g_rxErrorAt = UART_rx_queue_pushed(&g_rxQueue);
+			g_rxStatus = UART_OVERFLOW;
+		}
+	}
+}
+
+/* UDR is empty, feed it the next byte or stop the interrupt if nothing is left */
+ISR(USART_UDRE_vect) {
+	uint8 data;
+
+	if (UART_tx_queue_pop(&g_txQueue, &data) == TRUE) {
+		UDR = data;
+	} else {
+		/* Bit 5 - UDRIE: USART Data Register Empty Interrupt Disable */
+		CLEAR_BIT(UCSRB, UDRIE);
+	}
+}
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/*
+ * Bytes the application may read now: the bytes after a latched error wait
+ * until UART_takeRxStatus has reported it. The count is taken first, an error
+ * latched after it comes after all these bytes.
+ */
+static uint8 UART_readable(void) {
+	uint8 count = UART_rx_queue_count(&g_rxQueue);
+	uint8 before;
+
+	if (g_rxStatus != UART_OK) {
+		before = (uint8) (g_rxErrorAt - UART_rx_queue_popped(&g_rxQueue));
+		if (before < count) {
+			count = before;
+		}
+	}
+	return count;
+}
 
 /*******************************************************************************
  *                      Functions Definitions                                  *
@@ -28,113 +162,242 @@
  */
 void UART_init(const USART_configuration *config_ptr) {
 
-	uint16 ubrr_value_u2x = 0, ubrr_value_synch = 0;
+	/* Start with empty software buffers */
+	UART_rx_queue_init(&g_rxQueue);
+	g_rxStatus = UART_OK;
+	UART_tx_queue_init(&g_txQueue);
 
-	/* Bit 4  RXEN: Receiver Enable && Bit 3  TXEN: Transmitter Enable */
-	UCSRB = (1 << RXEN) | (1 << TXEN);
+	/* Bit 7 - RXCIE: RX Complete Interrupt Enable
+	 * Bit 4  RXEN: Receiver Enable && Bit 3  TXEN: Transmitter Enable */
+	UCSRB = (1 << RXCIE) | (1 << RXEN) | (1 << TXEN);
 
-	/* SELECTING UCSRC BY SETTING 1 TO 'URSEL' */
-	UCSRC |= (1 << URSEL);
+	/*
+	 * UCSRC shares its address with UBRRH and can not be read back safely,
+	 * so the whole frame format is written at once with URSEL = 1:
+	 * Bit 6  UMSEL: USART Mode Select
+	 * Bit 5:4  UPM1:0: Parity Mode
+	 * Bit 3  USBS: Stop Bit Select
+	 * Bit 2:1  UCSZ1:0: Character Size (UCSZ2 lives in UCSRB)
+	 * Bit 0  UCPOL: Clock Polarity
+	 */
+	UCSRC = (1 << URSEL) | ((config_ptr->mode) << UMSEL)
+			| ((config_ptr->parity) << UPM0) | ((config_ptr->stop) << USBS)
+			| (((config_ptr->size) & 0x03) << UCSZ0)
+			| ((config_ptr->polarity) << UCPOL);
 
-	/* DATA TRANSMITTED ON FALLING EDGE , AND SAMPLED ON POSITIVE EDGE || DATA TRANSMITTED ON FALLING EDGE , AND SAMPLED ON POSITIVE EDGE */
-	UCSRC = (UCSRC & 0xFE) | (config_ptr->polarity);
+	if ((*config_ptr).size == BIT_9) {
 
-	/* Bit 6  UMSEL: USART Mode Select */
-	UCSRC = (UCSRC & 0xBF) | (config_ptr->mode << 6);
+		/* Bit 2  UCSZ2: Character Size, TXB8 stays 0 for data frames */
+		UCSRB |= (1 << UCSZ2);
 
-	/* Bit 5:4  UPM1:0: Parity Mode */
-	UCSRC = (UCSRC & 0xCF) | (config_ptr->parity << 4);
+	}
 
-	/* Bit 3  USBS: Stop Bit Select */
-	UCSRC = (UCSRC & 0xF7) | (config_ptr->stop);
+	/* Every node listens to all frames until UART_setNodeAddress */
+	g_nodeAddress = UART_NO_ADDRESS;
 
-	/* Bit 2:1  UCSZ1:0: Character Size */
-	UCSRC = (UCSRC & 0xF9) | (config_ptr->size);
+	if ((*config_ptr).mode == ASYNCH) {
 
-	if ((*config_ptr).size == BIT_9) {
+		/* U2X and UBRR are selected at compile time in uart.h */
+#if UART_USE_2X
+		/* U2X = 1 for double transmission speed */
+		UCSRA = (1 << U2X);
+#else
+		UCSRA = 0;
+#endif
 
-		/* Bit 1  RXB8: Receive Data Bit 8 */
-		GPIO_readPin(UCSRB, RXB8);
+		/* First 8 bits from the UBRR value inside UBRRL and last 4 bits in UBRRH,
+		 * URSEL stays 0 so the write goes to UBRRH and not to UCSRC */
+		UBRRH = (uint8) (UART_UBRR_VALUE >> 8);
+		UBRRL = (uint8) UART_UBRR_VALUE;
 
-		/* Bit 0  TXB8: Transmit Data Bit 8 */
-		GPIO_writePin(UCSRB, TXB8, LOGIC_HIGH);
+	}
 
-		/* Bit 2  UCSZ2: Character Size */
-		UCSRB |= (1 << UCSZ2);
+	if ((*config_ptr).mode == SYNCH) {
 
-	}
+		/* U2X must be zero in synchronous mode */
+		UCSRA = 0;
 
-	if ((*config_ptr).mode == ASYNCH) {
+		UBRRH = (uint8) (UART_UBRR_SYNCH >> 8);
+		UBRRL = (uint8) UART_UBRR_SYNCH;
 
-		/* U2X = 1 for double transmission speed */
-		UCSRA = (1 << U2X);
+	}
 
-		/* Bit 15  URSEL: Register Select */
-		UBRRH |= (1 << URSEL);
+	/* Enable global interrupts in MC, the buffers are served by the ISRs */
+	SREG |= (1 << 7);
 
-		/* Calculate the UBRR register value */
-		ubrr_value_u2x = (uint16) (((F_CPU / (USART_BAUDRATE * 8UL))) - 1);
+}
 
-		/* First 8 bits from the BAUD_PRESCALE inside UBRRL and last 4 bits in UBRRH*/
-		UBRRH = ubrr_value_u2x >> 8;
-		UBRRL = ubrr_value_u2x;
+/*
+ * Description :
+ * Queue up to length bytes in the Tx buffer without waiting, the USART_UDRE
+ * interrupt moves them to the wire in the background.
+ * Return the number of bytes that fitted in the buffer.
+ */
+uint8 UART_write(const uint8 *data, uint8 length) {
+	uint8 count = 0;
 
+	/* Until the buffer is full, the caller gets back how much has been queued */
+	while ((count < length)
+			&& (UART_tx_queue_push(&g_txQueue, &data[count]) == TRUE)) {
+		count++;
 	}
 
-	if ((*config_ptr).mode == SYNCH) {
+	if (count != 0) {
+		/* Bit 5 - UDRIE: USART Data Register Empty Interrupt Enable */
+		SET_BIT(UCSRB, UDRIE);
+	}
 
-		/* Bit 15  URSEL: Register Select */
-		UBRRH |= (1 << URSEL);
+	return count;
+}
 
-		ubrr_value_synch = (uint16) (((F_CPU / (USART_BAUDRATE * 16UL))) - 1);
+/*
+ * Description :
+ * Queue several segments back to back straight from the caller's memory,
+ * without a staging copy, waiting only while the Tx buffer is full.
+ * If checksum is not NULL it is applied to every queued byte starting from
+ * *sum and the result is left in *sum.
+ */
+void UART_sendv(const UART_segment *segments, uint8 count,
+		UART_checksum checksum, uint16 *sum) {
+	const uint8 *data;
+	uint8 length;
+
+	while (count != 0) {
+		data = segments->data;
+		length = segments->length;
+
+		while (length != 0) {
+			/* Buffer full, wait for the UDRE ISR to free a slot */
+			while (UART_tx_queue_push(&g_txQueue, data) == FALSE) {
+			}
+
+			/* Start the transmission as soon as the first byte is queued */
+			SET_BIT(UCSRB, UDRIE);
+
+			if (checksum != NULL) {
+				*sum = checksum(*sum, *data);
+			}
+			data++;
+			length--;
+		}
+
+		segments++;
+		count--;
+	}
+}
 
-		/* First 8 bits from the BAUD_PRESCALE inside UBRRL and last 4 bits in UBRRH*/
-		UBRRH = ubrr_value_synch >> 8;
-		UBRRL = ubrr_value_synch;
+/*
+ * Description :
+ * Copy up to length received bytes from the Rx buffer without waiting.
+ * Return the number of bytes copied (0 if nothing was received yet). It stops
+ * at a receive error, UART_takeRxStatus reports it and lets the next bytes in.
+ */
+uint8 UART_read(uint8 *data, uint8 length) {
+	uint8 readable = UART_readable();
+	uint8 count = 0;
+
+	if (length > readable) {
+		length = readable;
+	}
 
+	while ((count < length)
+			&& (UART_rx_queue_pop(&g_rxQueue, &data[count]) == TRUE)) {
+		count++;
 	}
 
+	return count;
+}
+
+/*
+ * Description :
+ * Return the number of received bytes UART_read can copy now, the ones
+ * before the next receive error.
+ */
+uint8 UART_available(void) {
+	return UART_readable();
 }
 
 /*
  * Description :
  * Functional responsible for send byte to another UART device.
+ * Waits only if the Tx buffer is full.
  */
 void UART_sendByte(const uint8 data) {
-	/*
-	 * UDRE flag is set when the Tx buffer (UDR) is empty and ready for
-	 * transmitting a new byte so wait until this flag is set to one
-	 */
-	while (BIT_IS_CLEAR(UCSRA, UDRE)) {
+	/* The UDRE ISR frees a slot every character time */
+	while (UART_write(&data, 1) == 0) {
 	}
-
-	/*
-	 * Put the required data in the UDR register and it also clear the UDRE flag as
-	 * the UDR register is not empty now
-	 */
-	UDR = data;
-
-	/************************* Another Method *************************
-	 UDR = data;
-	 while(BIT_IS_CLEAR(UCSRA,TXC)){} // Wait until the transmission is complete TXC = 1
-	 SET_BIT(UCSRA,TXC); // Clear the TXC flag
-	 *******************************************************************/
 }
 
 /*
  * Description :
  * Functional responsible for receive byte from another UART device.
+ * Waits until the Rx buffer holds at least one byte. Receive errors are
+ * skipped, see the error counters.
  */
 uint8 UART_recieveByte(void) {
-	/* RXC flag is set when the UART receive data so wait until this flag is set to one */
-	while (BIT_IS_CLEAR(UCSRA, RXC)) {
+	uint8 data;
+
+	/* The RXC ISR fills the buffer in the background and wakes the CPU up */
+	while (UART_read(&data, 1) == 0) {
+		if (UART_takeRxStatus() == UART_OK) {
+			IDLE_sleep();
+		}
 	}
 
-	/*
-	 * Read the received data from the Rx buffer (UDR)
-	 * The RXC flag will be cleared after read the data
-	 */
-	return UDR;
+	return data;
+}
+
+/*
+ * Description :
+ * Return the error latched by the Rx ISR and clear it, for callers that poll
+ * the Rx buffer with UART_read. The error is only returned once the bytes
+ * received before it have been read, UART_OK until then.
+ */
+UART_status UART_takeRxStatus(void) {
+	uint8 sreg = SREG;
+	UART_status status;
+
+	/* The Rx ISR may latch a new error between the read and the clear */
+	cli();
+	status = g_rxStatus;
+	if (status != UART_OK) {
+		if (g_rxErrorAt == UART_rx_queue_popped(&g_rxQueue)) {
+			g_rxStatus = UART_OK;
+		} else {
+			status = UART_OK;
+		}
+	}
+	SREG = sreg;
+
+	return status;
+}
+
+/*
+ * Description :
+ * Wait at most timeout_ms (1 ms Timer0 tick) for one received byte.
+ * Return UART_OK, UART_TIMEOUT, or the error latched by the Rx ISR once the
+ * bytes received before it are read: UART_PARITY_ERROR or UART_FRAME_ERROR
+ * (the corrupted byte is dropped) or UART_OVERFLOW (a byte was lost by the
+ * hardware or because the Rx buffer was full).
+ */
+UART_status UART_receiveByteTimeout(uint8 *data, uint16 timeout_ms) {
+	UART_status status;
+	uint32 start = Timer_millis();
+
+	while (1) {
+		status = UART_takeRxStatus();
+		if (status != UART_OK) {
+			return status;
+		}
+		if (UART_read(data, 1) != 0) {
+			return UART_OK;
+		}
+		/* The current millisecond is already partly gone, wait one more */
+		if ((Timer_millis() - start) > timeout_ms) {
+			return UART_TIMEOUT;
+		}
+		IDLE_sleep();
+	}
 }
 
 /*
@@ -177,3 +440,132 @@ void UART_receiveString(uint8 *Str) {
 	/* After receiving the whole string plus the '#', replace the '#' with '\0' */
 	Str[i] = '\0';
 }
+
+/*
+ * Description :
+ * Receive until the '#' symbol like UART_receiveString, but give up after
+ * timeout_ms and never write more than max_length bytes (including the '\0').
+ * Return UART_OVERFLOW if no '#' fits in the buffer.
+ */
+UART_status UART_receiveStringTimeout(uint8 *Str, uint8 max_length,
+		uint16 timeout_ms) {
+	UART_status status;
+	uint8 i = 0;
+	uint32 start = Timer_millis();
+
+	if (max_length == 0) {
+		return UART_OVERFLOW;
+	}
+
+	while (1) {
+		status = UART_takeRxStatus();
+		if (status != UART_OK) {
+			break;
+		}
+
+		if (UART_read(&Str[i], 1) != 0) {
+			if (Str[i] == '#') {
+				break;
+			}
+			i++;
+
+			/* Keep the last place for the '\0' */
+			if (i == (max_length - 1)) {
+				status = UART_OVERFLOW;
+				break;
+			}
+		} else if ((Timer_millis() - start) > timeout_ms) {
+			status = UART_TIMEOUT;
+			break;
+		} else {
+			IDLE_sleep();
+		}
+	}
+
+	Str[i] = '\0';
+	return status;
+}
+
+/*
+ * Description :
+ * Set the function the Rx ISR calls after each byte put in the Rx buffer,
+ * e.g. to post an event to the main loop. NULL removes it.
+ */
+void UART_setRxCallBack(void (*a_ptr)(void)) {
+	g_rxCallBack = a_ptr;
+}
+
+/*
+ * Description :
+ * Copy the receive error counters, read with interrupts disabled.
+ */
+void UART_getErrorCounters(UART_error_counters *counters) {
+	uint8 sreg = SREG;
+
+	/* The 16-bit counters are updated by the Rx ISR */
+	cli();
+	counters->framing_errors = g_errorCounters.framing_errors;
+	counters->overrun_errors = g_errorCounters.overrun_errors;
+	counters->parity_errors = g_errorCounters.parity_errors;
+	counters->buffer_overflows = g_errorCounters.buffer_overflows;
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Reset the receive error counters to zero.
+ */
+void UART_clearErrorCounters(void) {
+	uint8 sreg = SREG;
+
+	cli();
+	g_errorCounters.framing_errors = 0;
+	g_errorCounters.overrun_errors = 0;
+	g_errorCounters.parity_errors = 0;
+	g_errorCounters.buffer_overflows = 0;
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Most bytes ever waiting in the Rx and Tx buffers, to size them.
+ */
+void UART_getBufferHighWater(uint8 *rx, uint8 *tx) {
+	*rx = UART_rx_queue_highWater(&g_rxQueue);
+	*tx = UART_tx_queue_highWater(&g_txQueue);
+}
+
+/*
+ * Description :
+ * Join a 9-bit multidrop bus as a slave with the given address: enable the
+ * multi-processor communication mode so data frames are ignored in hardware
+ * until an address frame selects this node.
+ */
+void UART_setNodeAddress(uint8 address) {
+	g_nodeAddress = address;
+
+	/* Bit 0 - MPCM: Multi-processor Communication Mode */
+	SET_BIT(UCSRA, MPCM);
+}
+
+/*
+ * Description :
+ * Bus master side: send an address frame (9th bit set) so only the node with
+ * that address receives the following data frames.
+ */
+void UART_selectNode(uint8 address) {
+
+	/* Let the queued data frames leave with the 9th bit cleared */
+	while ((UART_tx_queue_count(&g_txQueue) != 0)
+			|| BIT_IS_CLEAR(UCSRA, UDRE)) {
+	}
+
+	/* TXB8 has to be written before UDR */
+	SET_BIT(UCSRB, TXB8);
+	UDR = address;
+
+	/* TXB8 is copied with UDR to the shift register once UDRE is set again */
+	while (BIT_IS_CLEAR(UCSRA, UDRE)) {
+	}
+	CLEAR_BIT(UCSRB, TXB8);
+}
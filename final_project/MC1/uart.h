@@ -15,8 +15,72 @@
 
 #include "std_types.h"
 
-#define USART_BAUDRATE 9600
+#ifndef F_CPU
 #define F_CPU 1000000UL
+#endif
+
+/*
+ * Inter-ECU link baud rate, UBRR and U2X are worked out from it at compile
+ * time. At 1MHz only 9600 stays inside the error limit, 57600 and 115200
+ * need a baud friendly crystal such as 7.3728MHz (0.0% error).
+ */
+#ifndef USART_BAUDRATE
+#define USART_BAUDRATE 9600
+#endif
+
+/* Maximum accepted baud rate error in per mille (20 = 2.0%) */
+#ifndef UART_BAUD_ERROR_LIMIT
+#define UART_BAUD_ERROR_LIMIT 20
+#endif
+
+/* UBRR + 1 rounded to the nearest integer for normal (/16) and double (/8) speed */
+#define UART_DIVISOR_1X ((F_CPU + 8UL * USART_BAUDRATE) / (16UL * USART_BAUDRATE))
+#define UART_DIVISOR_2X ((F_CPU + 4UL * USART_BAUDRATE) / (8UL * USART_BAUDRATE))
+
+/* Baud rate really generated by each divisor */
+#define UART_ACTUAL_1X (UART_DIVISOR_1X ? F_CPU / (16UL * UART_DIVISOR_1X) : 0)
+#define UART_ACTUAL_2X (UART_DIVISOR_2X ? F_CPU / (8UL * UART_DIVISOR_2X) : 0)
+
+/* Absolute baud rate error of each divisor in per mille */
+#define UART_ERROR_OF(ACTUAL) \
+	((((ACTUAL) > USART_BAUDRATE) ? ((ACTUAL) - USART_BAUDRATE) : (USART_BAUDRATE - (ACTUAL))) * 1000UL / USART_BAUDRATE)
+#define UART_ERROR_1X UART_ERROR_OF(UART_ACTUAL_1X)
+#define UART_ERROR_2X UART_ERROR_OF(UART_ACTUAL_2X)
+
+/* Normal speed samples each bit 16 times so it wins unless U2X is more accurate */
+#if (UART_DIVISOR_1X != 0) && (UART_ERROR_1X <= UART_ERROR_2X)
+#define UART_USE_2X 0
+#define UART_UBRR_VALUE (UART_DIVISOR_1X - 1)
+#define UART_BAUD_ERROR UART_ERROR_1X
+#else
+#define UART_USE_2X 1
+#define UART_UBRR_VALUE (UART_DIVISOR_2X - 1)
+#define UART_BAUD_ERROR UART_ERROR_2X
+#endif
+
+#if (UART_DIVISOR_2X == 0) || (UART_BAUD_ERROR > UART_BAUD_ERROR_LIMIT)
+#error "USART_BAUDRATE can not be generated from F_CPU within UART_BAUD_ERROR_LIMIT"
+#endif
+
+#if (UART_UBRR_VALUE > 4095)
+#error "USART_BAUDRATE is too low for F_CPU, UBRR is only 12 bits"
+#endif
+
+/* Synchronous master clock is F_CPU / (2 * (UBRR + 1)) */
+#define UART_UBRR_SYNCH ((F_CPU / (2UL * USART_BAUDRATE)) - 1)
+
+/* Size of the interrupt driven software buffers (spsc.h), must be a power of
+ * two (up to 128) so the indices can wrap with a mask instead of a division */
+#define UART_RX_BUFFER_SIZE 32
+#define UART_TX_BUFFER_SIZE 32
+
+#if (UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) || (UART_RX_BUFFER_SIZE > 128)
+#error "UART_RX_BUFFER_SIZE must be a power of two not bigger than 128"
+#endif
+
+#if (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) || (UART_TX_BUFFER_SIZE > 128)
+#error "UART_TX_BUFFER_SIZE must be a power of two not bigger than 128"
+#endif
 
 typedef enum {
 
@@ -48,6 +112,37 @@ typedef enum {
 
 } USART_clock_polarity;
 
+/* Multidrop (9-bit) bus addresses, UART_NO_ADDRESS means not addressed */
+#define UART_NO_ADDRESS 0xFF
+
+/* Result of the receive calls that take a timeout */
+typedef enum {
+
+	UART_OK, UART_TIMEOUT, UART_OVERFLOW, UART_PARITY_ERROR, UART_FRAME_ERROR
+
+} UART_status;
+
+/* Receive error counters kept by the Rx ISR, they wrap around at 65535 */
+typedef struct {
+
+	uint16 framing_errors; /* FE: stop bit not found, byte dropped */
+	uint16 overrun_errors; /* DOR: UDR not read in time, a byte was lost */
+	uint16 parity_errors; /* PE: parity mismatch, byte dropped */
+	uint16 buffer_overflows; /* Rx buffer full, byte dropped */
+
+} UART_error_counters;
+
+/* One piece of a scattered message, see UART_sendv */
+typedef struct {
+
+	const uint8 *data;
+	uint8 length;
+
+} UART_segment;
+
+/* Running checksum updated with each byte as it is queued, e.g. a CRC-16 */
+typedef uint16 (*UART_checksum)(uint16 sum, uint8 data);
+
 typedef struct {
 
 	USART_parity_mode parity;
@@ -71,18 +166,64 @@ typedef struct {
  */
 void UART_init(const USART_configuration *config_ptr);
 
+/*
+ * Description :
+ * Queue up to length bytes in the Tx buffer without waiting, the USART_UDRE
+ * interrupt moves them to the wire in the background.
+ * Return the number of bytes that fitted in the buffer.
+ */
+uint8 UART_write(const uint8 *data, uint8 length);
+
+/*
+ * Description :
+ * Queue several segments back to back straight from the caller's memory,
+ * without a staging copy, waiting only while the Tx buffer is full.
+ * If checksum is not NULL it is applied to every queued byte starting from
+ * *sum and the result is left in *sum.
+ */
+void UART_sendv(const UART_segment *segments, uint8 count,
+		UART_checksum checksum, uint16 *sum);
+
+/*
+ * Description :
+ * Copy up to length received bytes from the Rx buffer without waiting.
+ * Return the number of bytes copied (0 if nothing was received yet). It stops
+ * at a receive error, UART_takeRxStatus reports it and lets the next bytes in.
+ */
+uint8 UART_read(uint8 *data, uint8 length);
+
+/*
+ * Description :
+ * Return the number of received bytes UART_read can copy now, the ones
+ * before the next receive error.
+ */
+uint8 UART_available(void);
+
 /*
  * Description :
  * Functional responsible for send byte to another UART device.
+ * Waits only if the Tx buffer is full.
  */
 void UART_sendByte(const uint8 data);
 
 /*
  * Description :
  * Functional responsible for receive byte from another UART device.
+ * Waits until the Rx buffer holds at least one byte. Receive errors are
+ * skipped, see the error counters.
  */
 uint8 UART_recieveByte();
 
+/*
+ * Description :
+ * Wait at most timeout_ms (1 ms Timer0 tick) for one received byte.
+ * Return UART_OK, UART_TIMEOUT, or the error latched by the Rx ISR once the
+ * bytes received before it are read: UART_PARITY_ERROR or UART_FRAME_ERROR
+ * (the corrupted byte is dropped) or UART_OVERFLOW (a byte was lost by the
+ * hardware or because the Rx buffer was full).
+ */
+UART_status UART_receiveByteTimeout(uint8 *data, uint16 timeout_ms);
+
 /*
  * Description :
  * Send the required string through UART to the other UART device.
@@ -95,4 +236,61 @@ void UART_sendString(const uint8 *Str);
  */
 void UART_receiveString(uint8 *Str); // Receive until #
 
+/*
+ * Description :
+ * Receive until the '#' symbol like UART_receiveString, but give up after
+ * timeout_ms and never write more than max_length bytes (including the '\0').
+ * Return UART_OVERFLOW if no '#' fits in the buffer.
+ */
+UART_status UART_receiveStringTimeout(uint8 *Str, uint8 max_length,
+		uint16 timeout_ms);
+
+/*
+ * Description :
+ * Return the error latched by the Rx ISR and clear it, for callers that poll
+ * the Rx buffer with UART_read. The error is only returned once the bytes
+ * received before it have been read, UART_OK until then.
+ */
+UART_status UART_takeRxStatus(void);
+
+/*
+ * Description :
+ * Set the function the Rx ISR calls after each byte put in the Rx buffer,
+ * e.g. to post an event to the main loop. NULL removes it.
+ */
+void UART_setRxCallBack(void (*a_ptr)(void));
+
+/*
+ * Description :
+ * Copy the receive error counters, read with interrupts disabled.
+ */
+void UART_getErrorCounters(UART_error_counters *counters);
+
+/*
+ * Description :
+ * Reset the receive error counters to zero.
+ */
+void UART_clearErrorCounters(void);
+
+/*
+ * Description :
+ * Most bytes ever waiting in the Rx and Tx buffers, to size them.
+ */
+void UART_getBufferHighWater(uint8 *rx, uint8 *tx);
+
+/*
+ * Description :
+ * Join a 9-bit multidrop bus as a slave with the given address: enable the
+ * multi-processor communication mode so data frames are ignored in hardware
+ * until an address frame selects this node.
+ */
+void UART_setNodeAddress(uint8 address);
+
+/*
+ * Description :
+ * Bus master side: send an address frame (9th bit set) so only the node with
+ * that address receives the following data frames.
+ */
+void UART_selectNode(uint8 address);
+
 #endif /* UART_H_ */
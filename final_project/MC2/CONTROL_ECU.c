@@ -6,152 +6,556 @@
  */
 
 #include "timer.h"
+#include "sw_timer.h"
+#include "idle.h"
 #include "external_eeprom.h"
+#include "eeprom_cache.h"
+#include "cred_store.h"
 #include "uart.h"
+#include "protocol.h"
 #include "motor.h"
 #include "buzzer.h"
+#include "fsm.h"
+#include "pt.h"
+#include "kernel.h"
 #include "std_types.h"
 
-#define DELAY_Keypad 2000
-#define DELAY_UART 100
+#if PROTOCOL_PW_LENGTH > CSTORE_VALUE_SIZE
+#error "The password does not fit in a credential store record"
+#endif
+
+/* Longest wait for the user to retry a wrong password before giving up */
+#define RETRY_TIMEOUT_MS 60000
+
+/* Wrong passwords in a row before the alarm */
+#define MAX_ATTEMPTS 3
+
+/*******************************************************************************
+ *                      Door State Machine                                     *
+ *******************************************************************************/
+
+typedef enum {
+	DOOR_CLOSED, DOOR_OPENING, DOOR_HOLDING, DOOR_CLOSING, DOOR_ALARM,
+	DOOR_STATE_COUNT
+} DOOR_state;
+
+typedef enum {
+	DOOR_EV_PW_OK,		/* OP_OPEN request with the right password */
+	DOOR_EV_PW_WRONG,	/* OP_OPEN request with a wrong password */
+	DOOR_EV_TIMEOUT		/* the phase timer (or the retry timer) expired */
+} DOOR_event;
+
+/*
+ * fsm.h calls the guards and actions with the machine. Only the phase timer
+ * reads its state, the others work on the one door and ignore it.
+ */
+boolean DOOR_LAST_ATTEMPT(FSM_machine *fsm);
+void DOOR_COUNT_ATTEMPT(FSM_machine *fsm);
+void DOOR_FORGET_ATTEMPTS(FSM_machine *fsm);
+void DOOR_CLOSED_ENTRY(FSM_machine *fsm);
+void DOOR_CLOSED_EXIT(FSM_machine *fsm);
+void DOOR_OPENING_ENTRY(FSM_machine *fsm);
+void DOOR_HOLDING_ENTRY(FSM_machine *fsm);
+void DOOR_CLOSING_ENTRY(FSM_machine *fsm);
+void DOOR_ALARM_ENTRY(FSM_machine *fsm);
+void DOOR_ALARM_EXIT(FSM_machine *fsm);
+
+/* Time spent in each state before DOOR_EV_TIMEOUT, 0 for no phase timer */
+static const uint8 g_doorPhaseSeconds[DOOR_STATE_COUNT] PROGMEM = { 0,
+		PROTOCOL_DOOR_OPENING_SECONDS, PROTOCOL_DOOR_HOLD_SECONDS,
+		PROTOCOL_DOOR_CLOSING_SECONDS, PROTOCOL_LOCKOUT_SECONDS };
+
+static const FSM_state_actions g_doorStates[DOOR_STATE_COUNT] PROGMEM = {
+		{ DOOR_CLOSED_ENTRY, DOOR_CLOSED_EXIT },	/* DOOR_CLOSED */
+		{ DOOR_OPENING_ENTRY, NULL },				/* DOOR_OPENING */
+		{ DOOR_HOLDING_ENTRY, NULL },				/* DOOR_HOLDING */
+		{ DOOR_CLOSING_ENTRY, NULL },				/* DOOR_CLOSING */
+		{ DOOR_ALARM_ENTRY, DOOR_ALARM_EXIT }		/* DOOR_ALARM */
+};
+
+static const FSM_transition g_doorTransitions[] PROGMEM = {
+		{ DOOR_CLOSED, DOOR_EV_PW_OK, NULL, NULL, DOOR_OPENING },
+		{ DOOR_CLOSED, DOOR_EV_PW_WRONG, DOOR_LAST_ATTEMPT, NULL, DOOR_ALARM },
+		{ DOOR_CLOSED, DOOR_EV_PW_WRONG, NULL, DOOR_COUNT_ATTEMPT, FSM_STAY },
+		{ DOOR_CLOSED, DOOR_EV_TIMEOUT, NULL, DOOR_FORGET_ATTEMPTS, FSM_STAY },
+		{ DOOR_OPENING, DOOR_EV_TIMEOUT, NULL, NULL, DOOR_HOLDING },
+		{ DOOR_HOLDING, DOOR_EV_TIMEOUT, NULL, NULL, DOOR_CLOSING },
+		{ DOOR_CLOSING, DOOR_EV_TIMEOUT, NULL, NULL, DOOR_CLOSED },
+		{ DOOR_ALARM, DOOR_EV_TIMEOUT, NULL, NULL, DOOR_CLOSED }
+};
+
+static const FSM_definition g_doorDefinition PROGMEM = { g_doorTransitions,
+		sizeof(g_doorTransitions) / sizeof(g_doorTransitions[0]), g_doorStates,
+		DOOR_STATE_COUNT };
 
 /*******************************************************************************
  *                      Global Variable                                   *
  *******************************************************************************/
 volatile uint8 Valid;
+
+/* Set by the software timer callback when the door timer expires */
+volatile uint8 g_timerExpired;
+
+FSM_machine g_door;
+
+/* Phase or retry timer of the door */
+volatile SW_timer_id g_doorTimer = SW_TIMER_INVALID;
+
+/* Wrong passwords in a row */
+uint8 g_attempts;
+
+/* Last request answered and its response, a retry of it gets the same answer */
+PROTOCOL_frame g_lastRequest;
+uint8 g_lastResponse[PROTOCOL_RESPONSE_LENGTH];
+boolean g_answered = FALSE;
+
+/* Cooperative tasks, run in turn by the main loop */
+PT_thread g_protocolTask;
+PT_thread g_doorTask;
+
+#if KERNEL_ENABLED
+/* Task stacks, the door task preempts the protocol task */
+#define DOOR_STACK_SIZE					160
+#define PROTOCOL_STACK_SIZE				160
+#define DOOR_PRIORITY					2
+#define PROTOCOL_PRIORITY				1
+
+uint8 g_doorStack[DOOR_STACK_SIZE];
+uint8 g_protocolStack[PROTOCOL_STACK_SIZE];
+
+/* Given by the door timer and by every received byte */
+KERNEL_semaphore g_doorSem;
+KERNEL_semaphore g_rxSem;
+
+/* Only one task at a time runs the door state machine */
+KERNEL_semaphore g_doorLock;
+#endif
+
 /*******************************************************************************
  *                      Function Prototype                                  *
  *******************************************************************************/
-void RECEIVE_PW(uint8 PW[]);
+uint8 PROTOCOL_TASK(PT_thread *pt);
+uint8 DOOR_TASK(PT_thread *pt);
+boolean VALID_REQUEST(const PROTOCOL_frame *request, uint8 operation);
+boolean REPEATED_REQUEST(const PROTOCOL_frame *request);
 void VERIFY_PW(uint8 PW[], uint8 check_pw[]);
-void timer0_isr_fn(void);
-
-volatile int quarter_sec = 0;
+void SEND_RESPONSE(const PROTOCOL_frame *request, uint8 verdict);
+void START_DOOR_TIMER(uint32 ticks);
+void TIMER_EXPIRED(void);
+void DOOR_DISPATCH(FSM_event event);
+#if KERNEL_ENABLED
+void DOOR_KERNEL_TASK(void);
+void PROTOCOL_KERNEL_TASK(void);
+void RX_RECEIVED(void);
+#endif
 
 int main(void) {
-	uint8 P_W[4];
-	uint8 check[4];
-	Timer0_setCallBack(timer0_isr_fn);
+	SWTIMER_init();
 
 	buzzer_init();
 
 	EEPROM_init();
+	ECACHE_init();
+	CSTORE_init();
 
 	MOTOR_init();
 
+	/* Asynchronous, even parity, one stop bit and 9-bit multidrop frames */
 	USART_configuration UConfig =
-			{ ENABLED_EVEN, BIT_1, BIT_8, ASYNCH, FALLING };
+			{ ENABLED_EVEN, BIT_1, BIT_9, ASYNCH, FALLING };
 	UART_init(&UConfig);
 
-	/* Timer configurations */
-	timer_configuration T0_Configuration = { NORMAL_MODE, F_CPU_1024, TIMER0, 0,
-			7812 };
+	/* Ignore requests sent to the other doors on the line */
+	UART_setNodeAddress(PROTOCOL_NODE_ADDRESS);
+
+	/* Timer0 as the 1 ms system tick */
+	timer_configuration T0_Configuration = { CTC_MODE, TIMER0_TICK_PRESCALER,
+			TIMER0, TIMER0_TICK_COMPARE, 0 };
 
 	/* Initialize Timer0 */
 	Timer_Init(&T0_Configuration);
 
-	// get pass and check it
-	do {
-		RECEIVE_PW(P_W);        	// RECIEVE FIRST PW USER SENDS
-		RECEIVE_PW(check);        // RECIEVE VERIFYING PW USER SENDS
-		VERIFY_PW(P_W, check);		//CHECK IF PW'S SENT FROM THE HMI MATCH
-	} while (Valid == 0);
+	/* Sleep in idle mode whenever there is nothing to do */
+	IDLE_init();
+
+	/* The door starts closed and locked */
+	FSM_init(&g_door, &g_doorDefinition, DOOR_CLOSED);
 
+	PT_INIT(&g_protocolTask);
+	PT_INIT(&g_doorTask);
+
+#if KERNEL_ENABLED
+	KERNEL_semInit(&g_doorSem, 0);
+	KERNEL_semInit(&g_rxSem, 0);
+	KERNEL_semInit(&g_doorLock, 1);
+	UART_setRxCallBack(RX_RECEIVED);
+
+	KERNEL_createTask(DOOR_KERNEL_TASK, DOOR_PRIORITY, g_doorStack,
+			DOOR_STACK_SIZE);
+	KERNEL_createTask(PROTOCOL_KERNEL_TASK, PROTOCOL_PRIORITY, g_protocolStack,
+			PROTOCOL_STACK_SIZE);
+
+	/* Never returns, main becomes the idle task */
+	KERNEL_start();
+#else
+	/*
+	 * The tasks only wait on conditions set by interrupts (received bytes,
+	 * timer expiries), so when they all wait the CPU sleeps until the next
+	 * interrupt.
+	 */
 	while (1) {
-		uint8 command = UART_receiveByte();
-		if (command == '-') {
-			do {
-				RECEIVE_PW(P_W);        	// RECIEVE FIRST PW USER SENDS
-				RECEIVE_PW(check);        // RECIEVE VERIFYING PW USER SENDS
-				VERIFY_PW(P_W, check);	//CHECK IF PW'S SENT FROM THE HMI MATCH
-			} while (Valid == 0);
-		}
+		PROTOCOL_TASK(&g_protocolTask);
+		DOOR_TASK(&g_doorTask);
+		ECACHE_flushStep();
+		IDLE_sleep();
+	}
+#endif
+}
 
-		/* Save password in EEPROM */
-		for (uint8 i = 0; i < 4; i++) {
-			EEPROM_writeByte((0X0090 + i), P_W[i]);
-			_delay_ms(DELAY_UART);
-		}
-		if (command == '+') {
+#if KERNEL_ENABLED
+/*
+ * The protothreads run unchanged as kernel tasks. The door task wakes on the
+ * timer expiry and preempts a protocol task busy with the EEPROM.
+ */
+void DOOR_KERNEL_TASK(void) {
+	while (1) {
+		KERNEL_semTake(&g_doorSem, KERNEL_WAIT_FOREVER);
+		DOOR_TASK(&g_doorTask);
+	}
+}
 
-			/* GET PASSWORD IN EEPROM AND SAVE IT IN A VARIABLE TO CHECK PW USER SENT */
-			for (uint8 i = 0; i < 4; i++) {
-				EEPROM_readByte((0x0090 + i), (P_W + i));
-				_delay_ms(100);
-			}
+/*
+ * Wakes on every received byte, and every tick to write the EEPROM cache
+ * back.
+ */
+void PROTOCOL_KERNEL_TASK(void) {
+	while (1) {
+		PROTOCOL_TASK(&g_protocolTask);
+		ECACHE_flushStep();
+		KERNEL_semTake(&g_rxSem, 1);
+	}
+}
 
-			uint8 count = 0;
-			do {
-				count++;
+/* UART receive callback, runs in the Rx interrupt */
+void RX_RECEIVED(void) {
+	KERNEL_semGive(&g_rxSem);
+}
+#endif
 
-				/* Receive password to check it  */
-				RECEIVE_PW(check);
+/*
+ * Talk to the HMI: take the first password, unless one is already in the
+ * credential store, then answer the requests. Every MSG_REQUEST gets exactly
+ * one response, one out of sequence or malformed is answered VERDICT_INVALID. A request the HMI sent again because the response was lost gets the same
+ * response again and is not run twice. Other requests that come while the
+ * door is moving or the alarm is on are answered VERDICT_BUSY without being
+ * run. It never blocks, so the door keeps running meanwhile: a password is
+ * saved with CSTORE_writeStep, which only starts the EEPROM operations in the
+ * background and is awaited like the received frames.
+ */
+uint8 PROTOCOL_TASK(PT_thread *pt) {
+	static PROTOCOL_frame request;
+	static uint8 P_W[PROTOCOL_PW_LENGTH];
+	static uint8 verdict;
+	static uint8 saved;
+	static uint8 i;
+
+	PT_BEGIN(pt);
+
+	/*
+	 * A password committed before a reset is used at once, the HMI learns
+	 * that one exists from the VERDICT_PW_SET answer to its OP_SET_PW
+	 */
+	if (CSTORE_read(CSTORE_KEY_PIN, P_W) != PROTOCOL_PW_LENGTH) {
+		// get pass and check it
+		do {
+			PT_AWAIT(pt,
+					(PROTOCOL_pollFrame(&request) == TRUE)
+							&& (request.type == MSG_REQUEST));
+
+			/* Nothing else is looked at before the first password */
+			if (VALID_REQUEST(&request, OP_SET_PW) == FALSE) {
+				verdict = (VALID_REQUEST(&request, OP_ANY) == TRUE) ?
+						VERDICT_NO_PW : VERDICT_INVALID;
+				SEND_RESPONSE(&request, verdict);
+				continue;
+			}
 
-				/* Check if the password is correct */
-				VERIFY_PW(P_W, check);
-			} while (Valid == 0 && count < 3);
+			//CHECK IF PW'S SENT FROM THE HMI MATCH
+			VERIFY_PW(&request.payload[PROTOCOL_PW_FIELD(0)],
+					&request.payload[PROTOCOL_PW_FIELD(1)]);
+			verdict = Valid ? VERDICT_VALID : VERDICT_INVALID;
 
+			/* The HMI is told the password is set only once it is saved */
 			if (Valid) {
-				SECONDS_T0_MC2 = 0;
-				while (SECONDS_T0_MC2 <= 15) {
-					MOTOR_clockw
-					;
-				}
-				while (SECONDS_T0_MC2 <= 18) {
-					MOTOR_stop
-					;
+				saved = CSTORE_writeStart(CSTORE_KEY_PIN,
+						&request.payload[PROTOCOL_PW_FIELD(0)],
+						PROTOCOL_PW_LENGTH);
+				PT_AWAIT(pt,
+						(saved == ERROR)
+								|| ((saved = CSTORE_writeStep()) != CSTORE_PENDING));
+				if (saved == ERROR) {
+					verdict = VERDICT_ERROR;
 				}
-				while (SECONDS_T0_MC2 <= 33) {
-					MOTOR_anti_clockw
-					;
-				}
-				MOTOR_stop
-				;
-			} else if (!Valid) {
-				buzzer_on();
-				SECONDS_T0_MC2 = 0;
-				while (SECONDS_T0_MC2 <= 60)
-					;
-				buzzer_off();
-				break;
 			}
+			SEND_RESPONSE(&request, verdict);
+		} while (verdict != VERDICT_VALID);
+		for (i = 0; i < PROTOCOL_PW_LENGTH; i++) {
+			P_W[i] = request.payload[PROTOCOL_PW_FIELD(0) + i];
 		}
+	}
 
+	while (1) {
+		PT_AWAIT(pt,
+				(PROTOCOL_pollFrame(&request) == TRUE)
+						&& (request.type == MSG_REQUEST));
+
+		if (REPEATED_REQUEST(&request) == TRUE) {
+			PROTOCOL_sendFrame(MSG_RESPONSE, g_lastResponse,
+					PROTOCOL_RESPONSE_LENGTH);
+			continue;
+		}
+
+		/* A malformed request or an unknown operation is still answered */
+		if (VALID_REQUEST(&request, OP_ANY) == FALSE) {
+			SEND_RESPONSE(&request, VERDICT_INVALID);
+			continue;
+		}
+
+		if (g_door.state != DOOR_CLOSED) {
+			SEND_RESPONSE(&request, VERDICT_BUSY);
+			continue;
+		}
+
+		if (request.payload[PROTOCOL_OPERATION_FIELD] == OP_CHANGE_PW) {
+			/* The old password must be right before the new pair is compared */
+			VERIFY_PW(P_W, &request.payload[PROTOCOL_PW_FIELD(0)]);
+			if (Valid) {
+				VERIFY_PW(&request.payload[PROTOCOL_PW_FIELD(1)],
+						&request.payload[PROTOCOL_PW_FIELD(2)]);
+			}
+			verdict = Valid ? VERDICT_VALID : VERDICT_INVALID;
+
+			/*
+			 * Save the new password in the credential store before it is used
+			 * or confirmed: if the save fails the old password stays in use
+			 * and the HMI is told so
+			 */
+			if (Valid) {
+				saved = CSTORE_writeStart(CSTORE_KEY_PIN,
+						&request.payload[PROTOCOL_PW_FIELD(1)], PROTOCOL_PW_LENGTH);
+				PT_AWAIT(pt,
+						(saved == ERROR)
+								|| ((saved = CSTORE_writeStep()) != CSTORE_PENDING));
+				if (saved == SUCCESS) {
+					for (i = 0; i < PROTOCOL_PW_LENGTH; i++) {
+						P_W[i] = request.payload[PROTOCOL_PW_FIELD(1) + i];
+					}
+				} else {
+					verdict = VERDICT_ERROR;
+				}
+			}
+			SEND_RESPONSE(&request, verdict);
+
+		} else if (request.payload[PROTOCOL_OPERATION_FIELD] == OP_OPEN) {
+			/*
+			 * Check if the password is correct, the door machine does the rest.
+			 * P_W always holds the committed password: it was read back whole
+			 * at boot, or taken from the OP_SET_PW or OP_CHANGE_PW that saved it.
+			 * The HMI locks its keypad only when told the alarm is on.
+			 */
+			VERIFY_PW(P_W, &request.payload[PROTOCOL_PW_FIELD(0)]);
+			DOOR_DISPATCH(Valid ? DOOR_EV_PW_OK : DOOR_EV_PW_WRONG);
+			SEND_RESPONSE(&request,
+					Valid ? VERDICT_VALID :
+					(g_door.state == DOOR_ALARM) ? VERDICT_LOCKOUT : VERDICT_INVALID);
+
+		} else {
+			/* OP_SET_PW again, the password is only changed with OP_CHANGE_PW */
+			SEND_RESPONSE(&request, VERDICT_PW_SET);
+		}
 	}
 
+	PT_END(pt);
 }
 
-void RECEIVE_PW(uint8 PW[]) {
-	for (uint8 i = 0; i < 4; i++) {
-		PW[i] = UART_receiveByte();
+/*
+ * Feed the door timer expiries to the door state machine: motor phases,
+ * alarm and retry window.
+ */
+uint8 DOOR_TASK(PT_thread *pt) {
+	PT_BEGIN(pt);
+
+	while (1) {
+		PT_AWAIT(pt, g_timerExpired);
+		g_timerExpired = FALSE;
+		DOOR_DISPATCH(DOOR_EV_TIMEOUT);
 	}
-	_delay_ms(DELAY_UART);
 
+	PT_END(pt);
 }
 
 void VERIFY_PW(uint8 PW[], uint8 check_pw[]) {
 
-	for (uint8 i = 0; i < 4; i++) {
+	for (uint8 i = 0; i < PROTOCOL_PW_LENGTH; i++) {
 		if (PW[i] != check_pw[i])	//IF ONE CHAR IS DIFFRENT THEN PW IS INVALID
 				{
-			UART_sendByte(0);
-			_delay_ms(DELAY_UART);
 			Valid = 0;
 			break;
 		}
 		Valid = 1;
 	}
+}
+
+/* Answer the request and keep both in case the HMI sends it again */
+void SEND_RESPONSE(const PROTOCOL_frame *request, uint8 verdict) {
+	g_lastRequest = *request;
+	g_lastResponse[PROTOCOL_OPERATION_FIELD] =
+			request->payload[PROTOCOL_OPERATION_FIELD];
+	g_lastResponse[PROTOCOL_SEQUENCE_FIELD] =
+			request->payload[PROTOCOL_SEQUENCE_FIELD];
+	g_lastResponse[PROTOCOL_VERDICT_FIELD] = verdict;
+	g_answered = TRUE;
 
-	if (Valid) {
-		UART_sendByte(1);
-		_delay_ms(DELAY_UART);
+	PROTOCOL_sendFrame(MSG_RESPONSE, g_lastResponse, PROTOCOL_RESPONSE_LENGTH);
+}
+
+/*
+ * A well formed MSG_REQUEST of the required operation (or of any known
+ * operation for OP_ANY), anything else is out of sequence. An unknown
+ * operation is refused here, PROTOCOL_REQUEST_LENGTH would take it for
+ * OP_CHANGE_PW.
+ */
+boolean VALID_REQUEST(const PROTOCOL_frame *request, uint8 operation) {
+	uint8 op = request->payload[PROTOCOL_OPERATION_FIELD];
+
+	return (request->type == MSG_REQUEST) && (request->length != 0)
+			&& ((op == OP_SET_PW) || (op == OP_OPEN) || (op == OP_CHANGE_PW))
+			&& ((operation == OP_ANY) || (op == operation))
+			&& (request->length == PROTOCOL_REQUEST_LENGTH(op));
+}
+
+/*
+ * The HMI sent the last request again, same sequence and passwords: its
+ * response was lost. A new request after an HMI reset may reuse the
+ * sequence, it is only taken for a retry if its passwords are the same too.
+ */
+boolean REPEATED_REQUEST(const PROTOCOL_frame *request) {
+	uint8 i;
+
+	if ((g_answered == FALSE) || (request->length != g_lastRequest.length)) {
+		return FALSE;
+	}
+	for (i = 0; i < request->length; i++) {
+		if (request->payload[i] != g_lastRequest.payload[i]) {
+			return FALSE;
+		}
 	}
+	return TRUE;
 }
-void timer0_isr_fn(void) {
-	quarter_sec++;
-	if (quarter_sec == 30) {
-		SECONDS_T0_MC1++;
-		SECONDS_T0_MC2++;
-		quarter_sec = 0;
+
+/*
+ * (Re)start the one-shot door timer, a pending expiry of the previous one is
+ * forgotten so it can not end the new phase early.
+ */
+void START_DOOR_TIMER(uint32 ticks) {
+	if (g_doorTimer != SW_TIMER_INVALID) {
+		SWTIMER_cancel(g_doorTimer);
+		g_doorTimer = SW_TIMER_INVALID;
 	}
+	g_timerExpired = FALSE;
+
+	if (ticks != 0) {
+		g_doorTimer = SWTIMER_start(ticks, 0, TIMER_EXPIRED);
+	}
+}
+
+/* Software timer callback of the door timer, runs in the Timer0 interrupt */
+void TIMER_EXPIRED(void) {
+	g_doorTimer = SW_TIMER_INVALID;
+	g_timerExpired = TRUE;
+#if KERNEL_ENABLED
+	KERNEL_semGive(&g_doorSem);
+#endif
+}
+
+/* Feed an event to the door state machine */
+void DOOR_DISPATCH(FSM_event event) {
+#if KERNEL_ENABLED
+	KERNEL_semTake(&g_doorLock, KERNEL_WAIT_FOREVER);
+#endif
+	FSM_dispatch(&g_door, event);
+#if KERNEL_ENABLED
+	KERNEL_semGive(&g_doorLock);
+#endif
+}
+
+/*******************************************************************************
+ *                      Door Guards and Actions                                *
+ *******************************************************************************/
+
+/* Start the phase timer of the state just entered */
+static void DOOR_START_PHASE(FSM_machine *fsm) {
+	START_DOOR_TIMER(
+			SW_TIMER_SECONDS(pgm_read_byte(&g_doorPhaseSeconds[fsm->state])));
+}
+
+/* If the password has been entered wrongly for three times */
+boolean DOOR_LAST_ATTEMPT(FSM_machine *fsm) {
+	(void) fsm;
+	return (g_attempts + 1) >= MAX_ATTEMPTS;
+}
+
+/* Wait RETRY_TIMEOUT_MS for the user to try again */
+void DOOR_COUNT_ATTEMPT(FSM_machine *fsm) {
+	(void) fsm;
+	g_attempts++;
+	START_DOOR_TIMER(RETRY_TIMEOUT_MS);
+}
+
+/* The HMI went quiet, no door movement and no alarm */
+void DOOR_FORGET_ATTEMPTS(FSM_machine *fsm) {
+	(void) fsm;
+	g_attempts = 0;
+}
+
+void DOOR_CLOSED_ENTRY(FSM_machine *fsm) {
+	(void) fsm;
+	MOTOR_stop
+	;
+	g_attempts = 0;
+}
+
+void DOOR_CLOSED_EXIT(FSM_machine *fsm) {
+	(void) fsm;
+	START_DOOR_TIMER(0);
+}
+
+/* DOOR OPENS IN 15 SECONDS AND STAYS OPENED FOR 3 SECONDS AND STARTS
+ * CLOSING AGAIN IN 15 SECONDS */
+void DOOR_OPENING_ENTRY(FSM_machine *fsm) {
+	MOTOR_clockw
+	;
+	DOOR_START_PHASE(fsm);
+}
+
+void DOOR_HOLDING_ENTRY(FSM_machine *fsm) {
+	MOTOR_stop
+	;
+	DOOR_START_PHASE(fsm);
+}
+
+void DOOR_CLOSING_ENTRY(FSM_machine *fsm) {
+	MOTOR_anti_clockw
+	;
+	DOOR_START_PHASE(fsm);
+}
+
+void DOOR_ALARM_ENTRY(FSM_machine *fsm) {
+	buzzer_start();
+	DOOR_START_PHASE(fsm);
+}
+
+void DOOR_ALARM_EXIT(FSM_machine *fsm) {
+	(void) fsm;
+	buzzer_stop();
 }
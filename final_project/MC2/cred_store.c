@@ -0,0 +1,404 @@
+/******************************************************************************
+ *
+ * Module: CRED_STORE
+ *
+ * File Name: cred_store.c
+ *
+ * Description: Source file for the wear-levelled log-structured credential store
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "cred_store.h"
+#include "eeprom_cache.h"
+#include "idle.h" /* Sleep while CSTORE_write waits for the EEPROM */
+#include "protocol.h" /* To use PROTOCOL_crc16 */
+
+/*******************************************************************************
+ *                      Types and Global Variables (Private)                   *
+ *******************************************************************************/
+
+/* Record layout, one EEPROM page */
+#define CSTORE_SEQUENCE_HIGH			0
+#define CSTORE_SEQUENCE_LOW				1
+#define CSTORE_KEY						2
+#define CSTORE_LENGTH					3
+#define CSTORE_VALUE					4
+#define CSTORE_CRC_HIGH					(EEPROM_PAGE_SIZE - 3)
+#define CSTORE_CRC_LOW					(EEPROM_PAGE_SIZE - 2)
+#define CSTORE_COMMIT					(EEPROM_PAGE_SIZE - 1)
+
+/* Commit marker, written alone once the rest of the record is in the EEPROM */
+#define CSTORE_COMMITTED				0x5A
+#define CSTORE_UNCOMMITTED				0xFF
+
+/* Key without a record */
+#define CSTORE_NO_SLOT					0xFF
+
+/* Steps of a write, see CSTORE_writeStep */
+typedef enum {
+	CSTORE_IDLE,	/* no write running */
+	CSTORE_FETCH,	/* bringing the head page into the cache */
+	CSTORE_RECORD,	/* record with its marker cleared being written */
+	CSTORE_MARKER,	/* commit marker being written */
+	CSTORE_ROLLBACK	/* marker cleared again after its write failed */
+} CSTORE_step;
+
+/* Slot (page of the region) holding the newest record of each key */
+static uint8 g_live[CSTORE_KEYS];
+
+/* Values of the live records, read without touching the EEPROM */
+static uint8 g_values[CSTORE_KEYS][CSTORE_VALUE_SIZE];
+static uint8 g_lengths[CSTORE_KEYS];
+
+/* Slot written next, never a live record between two writes */
+static uint8 g_head = 0;
+
+/* Sequence number of the newest record */
+static uint16 g_sequence = 0;
+
+static CSTORE_statistics g_statistics;
+
+/* Write in progress: the value asked for, and the record being appended */
+static CSTORE_step g_step = CSTORE_IDLE;
+static uint8 g_writeKey;
+static uint8 g_writeValue[CSTORE_VALUE_SIZE];
+static uint8 g_writeLength;
+static uint8 g_record[EEPROM_PAGE_SIZE];
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+static uint16 CSTORE_address(uint8 slot) {
+	return CSTORE_REGION_START + ((uint16) slot * EEPROM_PAGE_SIZE);
+}
+
+static uint8 CSTORE_next(uint8 slot) {
+	return (slot == (CSTORE_REGION_PAGES - 1)) ? 0 : (slot + 1);
+}
+
+/* Sequence a is newer than b, also across the 65535 -> 0 wrap */
+static boolean CSTORE_newer(uint16 a, uint16 b) {
+	return ((sint16) (a - b) > 0);
+}
+
+static uint16 CSTORE_crc(const uint8 *record) {
+	uint16 crc = PROTOCOL_CRC_SEED;
+	uint8 i;
+
+	for (i = 0; i < CSTORE_CRC_HIGH; i++) {
+		crc = PROTOCOL_crc16(crc, record[i]);
+	}
+	return crc;
+}
+
+/*
+ * An erased page (0xFF), a torn write or a record whose commit marker did not
+ * land never passes
+ */
+static boolean CSTORE_valid(const uint8 *record) {
+	uint16 crc = CSTORE_crc(record);
+
+	return (record[CSTORE_COMMIT] == CSTORE_COMMITTED)
+			&& (record[CSTORE_KEY] < CSTORE_KEYS)
+			&& (record[CSTORE_LENGTH] <= CSTORE_VALUE_SIZE)
+			&& (record[CSTORE_CRC_HIGH] == (uint8) (crc >> 8))
+			&& (record[CSTORE_CRC_LOW] == (uint8) crc);
+}
+
+/* Key whose newest record is in slot, CSTORE_KEYS if none */
+static uint8 CSTORE_liveKey(uint8 slot) {
+	uint8 key;
+
+	for (key = 0; key < CSTORE_KEYS; key++) {
+		if (g_live[key] == slot) {
+			break;
+		}
+	}
+	return key;
+}
+
+/* Build in g_record the next record of key, its marker cleared */
+static void CSTORE_build(uint8 key, const uint8 *value, uint8 length) {
+	uint16 sequence = g_sequence + 1;
+	uint16 crc;
+	uint8 i;
+
+	g_record[CSTORE_SEQUENCE_HIGH] = (uint8) (sequence >> 8);
+	g_record[CSTORE_SEQUENCE_LOW] = (uint8) sequence;
+	g_record[CSTORE_KEY] = key;
+	g_record[CSTORE_LENGTH] = length;
+	for (i = 0; i < CSTORE_VALUE_SIZE; i++) {
+		g_record[CSTORE_VALUE + i] = (i < length) ? value[i] : 0xFF;
+	}
+	crc = CSTORE_crc(g_record);
+	g_record[CSTORE_CRC_HIGH] = (uint8) (crc >> 8);
+	g_record[CSTORE_CRC_LOW] = (uint8) crc;
+	g_record[CSTORE_COMMIT] = CSTORE_UNCOMMITTED;
+}
+
+/*
+ * Pick the next record to append at the head. Compaction: the head must stay
+ * on a dead record. The slot after it is overwritten by the next append, so
+ * the live record of another key there is copied to the head first. The old
+ * copy stays valid until then, a power failure in between loses nothing.
+ */
+static void CSTORE_nextAppend(void) {
+	uint8 other = CSTORE_liveKey(CSTORE_next(g_head));
+
+	if ((other != CSTORE_KEYS) && (other != g_writeKey)) {
+		CSTORE_build(other, g_values[other], g_lengths[other]);
+	} else {
+		CSTORE_build(g_writeKey, g_writeValue, g_writeLength);
+	}
+	g_step = CSTORE_FETCH;
+}
+
+/* The record in g_record is committed at the head, take it into RAM */
+static void CSTORE_committed(void) {
+	uint8 key = g_record[CSTORE_KEY];
+	uint8 i;
+
+	g_statistics.page_writes[g_head] += 2;
+
+	g_sequence = ((uint16) g_record[CSTORE_SEQUENCE_HIGH] << 8)
+			| g_record[CSTORE_SEQUENCE_LOW];
+	g_live[key] = g_head;
+	g_lengths[key] = g_record[CSTORE_LENGTH];
+	for (i = 0; i < g_lengths[key]; i++) {
+		g_values[key][i] = g_record[CSTORE_VALUE + i];
+	}
+	g_head = CSTORE_next(g_head);
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Scan the region once to find the newest record of every key and the log
+ * head, call it after ECACHE_init.
+ */
+void CSTORE_init(void) {
+	uint8 record[EEPROM_PAGE_SIZE];
+	uint16 sequences[CSTORE_KEYS];
+	uint16 sequence;
+	boolean found = FALSE;
+	uint8 slot;
+	uint8 key;
+	uint8 i;
+
+	for (key = 0; key < CSTORE_KEYS; key++) {
+		g_live[key] = CSTORE_NO_SLOT;
+		g_lengths[key] = 0;
+	}
+	g_head = 0;
+	g_sequence = 0;
+	g_step = CSTORE_IDLE;
+
+	for (slot = 0; slot < CSTORE_REGION_PAGES; slot++) {
+		if ((ECACHE_read(CSTORE_address(slot), record, EEPROM_PAGE_SIZE)
+				== ERROR) || (CSTORE_valid(record) == FALSE)) {
+			continue;
+		}
+		sequence = ((uint16) record[CSTORE_SEQUENCE_HIGH] << 8)
+				| record[CSTORE_SEQUENCE_LOW];
+		key = record[CSTORE_KEY];
+
+		if ((g_live[key] == CSTORE_NO_SLOT)
+				|| CSTORE_newer(sequence, sequences[key])) {
+			g_live[key] = slot;
+			sequences[key] = sequence;
+			g_lengths[key] = record[CSTORE_LENGTH];
+			for (i = 0; i < CSTORE_VALUE_SIZE; i++) {
+				g_values[key][i] = record[CSTORE_VALUE + i];
+			}
+		}
+
+		/* The log goes on after the newest record */
+		if ((found == FALSE) || CSTORE_newer(sequence, g_sequence)) {
+			found = TRUE;
+			g_sequence = sequence;
+			g_head = CSTORE_next(slot);
+		}
+	}
+}
+
+/*
+ * Description :
+ * Copy the value of key (from RAM) and return its length, 0 if the key has
+ * never been written.
+ */
+uint8 CSTORE_read(uint8 key, uint8 *value) {
+	uint8 i;
+
+	if (key >= CSTORE_KEYS) {
+		return 0;
+	}
+	for (i = 0; i < g_lengths[key]; i++) {
+		value[i] = g_values[key][i];
+	}
+	return g_lengths[key];
+}
+
+/*
+ * Description :
+ * Start writing the new value of key (length up to CSTORE_VALUE_SIZE), the
+ * value is copied. Nothing is written if the value is unchanged.
+ * Return ERROR for a wrong key or length or if a write is still running,
+ * then call CSTORE_writeStep until the write is over.
+ */
+uint8 CSTORE_writeStart(uint8 key, const uint8 *value, uint8 length) {
+	uint8 i;
+
+	if ((key >= CSTORE_KEYS) || (length > CSTORE_VALUE_SIZE)
+			|| (g_step != CSTORE_IDLE)) {
+		return ERROR;
+	}
+
+	if ((g_live[key] != CSTORE_NO_SLOT) && (g_lengths[key] == length)) {
+		for (i = 0; (i < length) && (g_values[key][i] == value[i]); i++) {
+		}
+		if (i == length) {
+			g_statistics.skipped++;
+			return SUCCESS;
+		}
+	}
+
+	g_writeKey = key;
+	g_writeLength = length;
+	for (i = 0; i < length; i++) {
+		g_writeValue[i] = value[i];
+	}
+	CSTORE_nextAppend();
+
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Move the write started by CSTORE_writeStart on without waiting, every
+ * EEPROM operation runs in the background. Return CSTORE_PENDING until the
+ * new value is committed in the EEPROM (SUCCESS) or the write failed (ERROR),
+ * the old value is kept then.
+ *
+ * Each record (a compaction copy, then the new value) is appended at the
+ * head in two page writes:
+ * 1. the record with its commit marker cleared,
+ * 2. once the chip has ACKed the end of that write cycle, the marker (the
+ *    cache writes the page back again with the other bytes unchanged).
+ * A power failure before step 2 completes leaves an uncommitted record that
+ * the boot scan ignores, the previous record of the key is still intact.
+ * When step 2 fails the marker is not left dirty in the cache, the lazy flush
+ * would commit the record after ERROR was reported: it is written back
+ * cleared, or the page is dropped from the cache if even that fails.
+ */
+uint8 CSTORE_writeStep(void) {
+	uint8 marker = CSTORE_COMMITTED;
+	uint8 result;
+
+	switch (g_step) {
+	case CSTORE_FETCH:
+		/* Once the page is cached the writes below never wait */
+		result = ECACHE_prefetch(CSTORE_address(g_head));
+		if (result == SUCCESS) {
+			result = ECACHE_write(CSTORE_address(g_head), g_record,
+					EEPROM_PAGE_SIZE);
+		}
+		if (result == SUCCESS) {
+			g_step = CSTORE_RECORD;
+			result = ECACHE_PENDING;
+		}
+		break;
+
+	case CSTORE_RECORD:
+		result = ECACHE_flushPoll();
+		if (result == SUCCESS) {
+			result = ECACHE_write(CSTORE_address(g_head) + CSTORE_COMMIT,
+					&marker, 1);
+		}
+		if (result == SUCCESS) {
+			g_step = CSTORE_MARKER;
+			result = ECACHE_PENDING;
+		} else if (result == ERROR) {
+			/* Drop the record from the cache, the EEPROM is read again if needed */
+			ECACHE_discard(CSTORE_address(g_head));
+		}
+		break;
+
+	case CSTORE_MARKER:
+		result = ECACHE_flushPoll();
+		if (result == SUCCESS) {
+			/* The record is only valid in RAM once it is committed */
+			if (g_record[CSTORE_KEY] != g_writeKey) {
+				g_statistics.copies++;
+				CSTORE_committed();
+				CSTORE_nextAppend();
+				result = ECACHE_PENDING;
+			} else {
+				g_statistics.appends++;
+				CSTORE_committed();
+			}
+		} else if (result == ERROR) {
+			marker = CSTORE_UNCOMMITTED;
+			if (ECACHE_write(CSTORE_address(g_head) + CSTORE_COMMIT, &marker, 1)
+					== SUCCESS) {
+				g_step = CSTORE_ROLLBACK;
+				result = ECACHE_PENDING;
+			} else {
+				ECACHE_discard(CSTORE_address(g_head));
+			}
+		}
+		break;
+
+	case CSTORE_ROLLBACK:
+		/* The write has failed whatever happens to the rollback */
+		result = ECACHE_flushPoll();
+		if (result == ERROR) {
+			ECACHE_discard(CSTORE_address(g_head));
+		} else if (result == SUCCESS) {
+			result = ERROR;
+		}
+		break;
+
+	default:
+		return SUCCESS;
+	}
+
+	if (result == ECACHE_PENDING) {
+		return CSTORE_PENDING;
+	}
+	g_step = CSTORE_IDLE;
+	return result;
+}
+
+/*
+ * Description :
+ * Write the new value of key like CSTORE_writeStart and wait until it is in
+ * the EEPROM. Return SUCCESS or ERROR.
+ */
+uint8 CSTORE_write(uint8 key, const uint8 *value, uint8 length) {
+	uint8 result;
+
+	if (CSTORE_writeStart(key, value, length) == ERROR) {
+		return ERROR;
+	}
+
+	/* The TWI interrupt ends every EEPROM operation */
+	while ((result = CSTORE_writeStep()) == CSTORE_PENDING) {
+		IDLE_sleep();
+	}
+
+	return result;
+}
+
+/*
+ * Description :
+ * Copy the append, compaction and wear counters.
+ */
+void CSTORE_getStatistics(CSTORE_statistics *statistics) {
+	*statistics = g_statistics;
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ *
+ * Module: CRED_STORE
+ *
+ * File Name: cred_store.h
+ *
+ * Description: Header file for the wear-levelled log-structured credential store
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef CRED_STORE_H_
+#define CRED_STORE_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * The store is a circular log of records over CSTORE_REGION_PAGES EEPROM
+ * pages starting at CSTORE_REGION_START, one record per page:
+ * | SEQUENCE high | SEQUENCE low | KEY | LENGTH | VALUE (9 bytes) | CRC16 | COMMIT |
+ * A write appends a record with the next sequence number, the newest valid
+ * record of a key holds its value. Every page is written once per lap of
+ * the log, so the wear is spread over the whole region.
+ *
+ * A record only becomes valid when its COMMIT marker is written, after the
+ * rest of the record. Until then the previous record of the key, never in
+ * the page being written, stays the valid one: an update is atomic even if
+ * the power fails in the middle.
+ */
+#ifndef CSTORE_REGION_START
+#define CSTORE_REGION_START				0x0100
+#endif
+
+#ifndef CSTORE_REGION_PAGES
+#define CSTORE_REGION_PAGES				8
+#endif
+
+/* Keys 0 .. CSTORE_KEYS - 1 */
+#ifndef CSTORE_KEYS
+#define CSTORE_KEYS						2
+#endif
+
+#define CSTORE_VALUE_SIZE				(EEPROM_PAGE_SIZE - 7)
+
+#if (CSTORE_REGION_START % EEPROM_PAGE_SIZE) != 0
+#error "CSTORE_REGION_START must be page aligned"
+#endif
+
+/* The live records of the other keys must fit besides the one being written */
+#if (CSTORE_REGION_PAGES < (CSTORE_KEYS + 2)) || (CSTORE_REGION_PAGES > 255)
+#error "CSTORE_REGION_PAGES must be between CSTORE_KEYS + 2 and 255"
+#endif
+
+/* Credentials kept by CONTROL_ECU */
+#define CSTORE_KEY_PIN					0
+
+/* Result of CSTORE_writeStep while the write goes on, besides SUCCESS and ERROR */
+#define CSTORE_PENDING					2
+
+typedef struct {
+	uint16 appends; /* Records written for a changed value */
+	uint16 copies; /* Live records moved ahead of the log head (compaction) */
+	uint16 skipped; /* Writes of an unchanged value, nothing written */
+	uint16 page_writes[CSTORE_REGION_PAGES]; /* Since boot, shows the wear spread */
+} CSTORE_statistics;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Scan the region once to find the newest record of every key and the log
+ * head, call it after ECACHE_init.
+ */
+void CSTORE_init(void);
+
+/*
+ * Description :
+ * Copy the value of key (from RAM) and return its length, 0 if the key has
+ * never been written.
+ */
+uint8 CSTORE_read(uint8 key, uint8 *value);
+
+/*
+ * Description :
+ * Start writing the new value of key (length up to CSTORE_VALUE_SIZE), the
+ * value is copied. Nothing is written if the value is unchanged.
+ * Return ERROR for a wrong key or length or if a write is still running,
+ * then call CSTORE_writeStep until the write is over.
+ */
+uint8 CSTORE_writeStart(uint8 key, const uint8 *value, uint8 length);
+
+/*
+ * Description :
+ * Move the write started by CSTORE_writeStart on without waiting, every
+ * EEPROM operation runs in the background. Return CSTORE_PENDING until the
+ * new value is committed in the EEPROM (SUCCESS) or the write failed (ERROR),
+ * the old value is kept then.
+ */
+uint8 CSTORE_writeStep(void);
+
+/*
+ * Description :
+ * Write the new value of key like CSTORE_writeStart and wait until it is in
+ * the EEPROM. Return SUCCESS or ERROR.
+ */
+uint8 CSTORE_write(uint8 key, const uint8 *value, uint8 length);
+
+/*
+ * Description :
+ * Copy the append, compaction and wear counters.
+ */
+void CSTORE_getStatistics(CSTORE_statistics *statistics);
+
+#endif /* CRED_STORE_H_ */
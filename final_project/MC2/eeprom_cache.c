@@ -0,0 +1,468 @@
+/******************************************************************************
+ *
+ * Module: EEPROM_CACHE
+ *
+ * File Name: eeprom_cache.c
+ *
+ * Description: Source file for the write-back RAM cache of the external EEPROM
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "eeprom_cache.h"
+#include "idle.h" /* Sleep while waiting for the EEPROM */
+#include "micro_config.h" /* To use SREG and cli */
+
+/*******************************************************************************
+ *                      Types and Global Variables (Private)                   *
+ *******************************************************************************/
+
+/* Page of an empty line, page addresses are multiples of EEPROM_PAGE_SIZE */
+#define ECACHE_NO_PAGE					0xFFFF
+
+/* No line is being written back */
+#define ECACHE_NO_LINE					0xFF
+
+typedef struct {
+	uint16 page; /* EEPROM address of data[0], ECACHE_NO_PAGE when empty */
+	uint8 last_use; /* g_clock at the last access, for the LRU replacement */
+	uint8 data[EEPROM_PAGE_SIZE];
+} ECACHE_line;
+
+static ECACHE_line g_lines[ECACHE_LINES];
+
+/* One bit per line that differs from the EEPROM, cleared when its flush starts */
+static volatile uint8 g_dirty = 0;
+
+/* Line written back in the background, its callback runs in the TWI interrupt */
+static volatile uint8 g_flushing = ECACHE_NO_LINE;
+
+/*
+ * Set when a background write back fails, the line is dirty again. Cleared
+ * when the failure is reported, the lazy flush does not retry until then.
+ */
+static volatile uint8 g_flushFailed = FALSE;
+
+/* Line read in the background by ECACHE_prefetch, and the page it gets */
+static volatile uint8 g_filling = ECACHE_NO_LINE;
+static uint16 g_fillPage;
+static volatile uint8 g_fillFailed = FALSE;
+
+/* Counts the accesses, only the differences with last_use matter */
+static uint8 g_clock = 0;
+
+static ECACHE_statistics g_statistics = { 0, 0, 0, 0, 0 };
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/* Sleep until the EEPROM has finished the running operation */
+static void ECACHE_waitEeprom(void) {
+	while (EEPROM_isBusy() == TRUE) {
+		IDLE_sleep();
+	}
+}
+
+static void ECACHE_setDirty(uint8 line) {
+	uint8 sreg = SREG;
+
+	cli();
+	g_dirty |= (1 << line);
+	SREG = sreg;
+}
+
+/* EEPROM callback of the background write back, runs in the TWI interrupt */
+static void ECACHE_flushDone(uint8 result) {
+	if (result == SUCCESS) {
+		g_statistics.flushes++;
+	} else {
+		/* Try again on the next flush */
+		g_dirty |= (1 << g_flushing);
+		g_flushFailed = TRUE;
+	}
+	g_flushing = ECACHE_NO_LINE;
+}
+
+/*
+ * Start writing a dirty line back. The EEPROM driver copies the page before
+ * this returns, so the line may be written again meanwhile: it is dirty again.
+ */
+static void ECACHE_startFlush(uint8 line) {
+	uint8 sreg = SREG;
+
+	cli();
+	g_dirty &= ~(1 << line);
+	g_flushing = line;
+	SREG = sreg;
+
+	if (EEPROM_writeBlockAsync(g_lines[line].page, g_lines[line].data,
+			EEPROM_PAGE_SIZE, ECACHE_flushDone) == ERROR) {
+		cli();
+		g_dirty |= (1 << line);
+		g_flushing = ECACHE_NO_LINE;
+		g_flushFailed = TRUE;
+		SREG = sreg;
+	}
+}
+
+/* EEPROM callback of the background read of ECACHE_prefetch */
+static void ECACHE_fillDone(uint8 result) {
+	if (result == SUCCESS) {
+		g_lines[g_filling].page = g_fillPage;
+	} else {
+		g_fillFailed = TRUE;
+	}
+	g_filling = ECACHE_NO_LINE;
+}
+
+/* Line caching page, ECACHE_LINES if none */
+static uint8 ECACHE_find(uint16 page) {
+	uint8 i;
+
+	for (i = 0; i < ECACHE_LINES; i++) {
+		if (g_lines[i].page == page) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* Line to reuse for a new page: an empty line, else the least recently used */
+static uint8 ECACHE_victim(void) {
+	uint8 i;
+	uint8 victim = 0;
+	uint8 age;
+	uint8 oldest = 0;
+
+	for (i = 0; i < ECACHE_LINES; i++) {
+		if (g_lines[i].page == ECACHE_NO_PAGE) {
+			return i;
+		}
+		age = g_clock - g_lines[i].last_use;
+		if (age > oldest) {
+			oldest = age;
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+/*
+ * Line caching page. On a miss the least recently used line is written back
+ * if dirty and reused for the page read from the EEPROM, waiting for both:
+ * a task that must not block calls ECACHE_prefetch first.
+ * Return NULL if the EEPROM failed.
+ */
+static ECACHE_line* ECACHE_getLine(uint16 page) {
+	uint8 victim;
+	ECACHE_line *line;
+
+	g_clock++;
+
+	/* A background read of ECACHE_prefetch may be bringing this very page */
+	if (g_filling != ECACHE_NO_LINE) {
+		ECACHE_waitEeprom();
+	}
+
+	victim = ECACHE_find(page);
+	if (victim != ECACHE_LINES) {
+		g_statistics.hits++;
+		g_lines[victim].last_use = g_clock;
+		return &g_lines[victim];
+	}
+	g_statistics.misses++;
+
+	victim = ECACHE_victim();
+	line = &g_lines[victim];
+
+	/*
+	 * A background write back of the victim must land before it is reused,
+	 * after that the TWI interrupt no longer touches g_dirty
+	 */
+	ECACHE_waitEeprom();
+
+	if (line->page != ECACHE_NO_PAGE) {
+		if (g_dirty & (1 << victim)) {
+			g_dirty &= ~(1 << victim);
+			if (EEPROM_writeBlock(line->page, line->data, EEPROM_PAGE_SIZE)
+					== ERROR) {
+				ECACHE_setDirty(victim);
+				return NULL;
+			}
+			g_statistics.flushes++;
+		}
+		g_statistics.evictions++;
+	}
+
+	/* Also read for a write, only the bytes that differ make the page dirty */
+	line->page = ECACHE_NO_PAGE;
+	if (EEPROM_readBlock(page, line->data, EEPROM_PAGE_SIZE) == ERROR) {
+		return NULL;
+	}
+	line->page = page;
+	line->last_use = g_clock;
+
+	return line;
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Empty the cache, call it after EEPROM_init.
+ */
+void ECACHE_init(void) {
+	uint8 i;
+
+	for (i = 0; i < ECACHE_LINES; i++) {
+		g_lines[i].page = ECACHE_NO_PAGE;
+	}
+	g_dirty = 0;
+	g_flushing = ECACHE_NO_LINE;
+	g_flushFailed = FALSE;
+	g_filling = ECACHE_NO_LINE;
+	g_fillFailed = FALSE;
+}
+
+/*
+ * Description :
+ * Copy length bytes, the pages not cached are read from the EEPROM first
+ * (read-through). Return SUCCESS or ERROR.
+ */
+uint8 ECACHE_read(uint16 u16addr, uint8 *data, uint16 length) {
+	ECACHE_line *line;
+	uint8 offset;
+	uint8 count;
+
+	while (length != 0) {
+		offset = u16addr & (EEPROM_PAGE_SIZE - 1);
+		count = EEPROM_PAGE_SIZE - offset;
+		if (length < count) {
+			count = (uint8) length;
+		}
+
+		line = ECACHE_getLine(u16addr - offset);
+		if (line == NULL) {
+			return ERROR;
+		}
+		u16addr += count;
+		length -= count;
+		while (count != 0) {
+			*data++ = line->data[offset++];
+			count--;
+		}
+	}
+
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Copy length bytes into the cached pages and mark the pages that really
+ * changed dirty, the EEPROM is written later by ECACHE_flushStep or
+ * ECACHE_flush (write-back). Pages not cached are read first.
+ * Return SUCCESS or ERROR.
+ */
+uint8 ECACHE_write(uint16 u16addr, const uint8 *data, uint16 length) {
+	ECACHE_line *line;
+	uint8 offset;
+	uint8 count;
+	boolean changed = FALSE;
+
+	while (length != 0) {
+		offset = u16addr & (EEPROM_PAGE_SIZE - 1);
+		count = EEPROM_PAGE_SIZE - offset;
+		if (length < count) {
+			count = (uint8) length;
+		}
+
+		line = ECACHE_getLine(u16addr - offset);
+		if (line == NULL) {
+			return ERROR;
+		}
+		u16addr += count;
+		length -= count;
+		while (count != 0) {
+			if (line->data[offset] != *data) {
+				line->data[offset] = *data;
+				ECACHE_setDirty((uint8) (line - g_lines));
+				changed = TRUE;
+			}
+			data++;
+			offset++;
+			count--;
+		}
+	}
+
+	if (changed == FALSE) {
+		g_statistics.clean_writes++;
+	}
+
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Bring the page holding u16addr into the cache without waiting, for tasks
+ * that must not block: call it again until it returns SUCCESS, then
+ * ECACHE_read and ECACHE_write of that page do not touch the EEPROM.
+ * Return ECACHE_PENDING while a dirty victim is written back or the page is
+ * read in the background, ERROR if the EEPROM failed (the next call starts
+ * over).
+ */
+uint8 ECACHE_prefetch(uint16 u16addr) {
+	uint16 page = u16addr & ~(EEPROM_PAGE_SIZE - 1);
+	uint8 victim = ECACHE_find(page);
+
+	if (victim != ECACHE_LINES) {
+		g_lines[victim].last_use = g_clock;
+		return SUCCESS;
+	}
+	if (g_fillFailed == TRUE) {
+		g_fillFailed = FALSE;
+		return ERROR;
+	}
+
+	/* One background operation at a time, the victim must not be in flight */
+	if ((g_filling != ECACHE_NO_LINE) || (g_flushing != ECACHE_NO_LINE)
+			|| (EEPROM_isBusy() == TRUE)) {
+		return ECACHE_PENDING;
+	}
+
+	victim = ECACHE_victim();
+	if (g_dirty & (1 << victim)) {
+		if (g_flushFailed == TRUE) {
+			g_flushFailed = FALSE;
+			return ERROR;
+		}
+		ECACHE_startFlush(victim);
+		return ECACHE_PENDING;
+	}
+
+	g_statistics.misses++;
+	if (g_lines[victim].page != ECACHE_NO_PAGE) {
+		g_statistics.evictions++;
+	}
+
+	/* Not a hit until the whole page is in */
+	g_lines[victim].page = ECACHE_NO_PAGE;
+	g_lines[victim].last_use = g_clock;
+	g_fillPage = page;
+	g_filling = victim;
+	if (EEPROM_readBlockAsync(page, g_lines[victim].data, EEPROM_PAGE_SIZE,
+			ECACHE_fillDone) == ERROR) {
+		g_filling = ECACHE_NO_LINE;
+		return ERROR;
+	}
+
+	return ECACHE_PENDING;
+}
+
+/*
+ * Description :
+ * Start writing back one dirty page in the background if the EEPROM is
+ * free, call it from the main loop (lazy flush). Never waits. After a failed
+ * write back it waits until ECACHE_flushPoll, ECACHE_flush or
+ * ECACHE_prefetch has reported the failure, so the writer can undo its
+ * change before the page is written again.
+ */
+void ECACHE_flushStep(void) {
+	uint8 line = 0;
+
+	if ((g_dirty == 0) || (g_flushing != ECACHE_NO_LINE)
+			|| (g_flushFailed == TRUE) || (EEPROM_isBusy() == TRUE)) {
+		return;
+	}
+
+	while (!(g_dirty & (1 << line))) {
+		line++;
+	}
+	ECACHE_startFlush(line);
+}
+
+/*
+ * Description :
+ * Write back all the dirty pages and wait until they are written.
+ * Return SUCCESS or ERROR.
+ */
+uint8 ECACHE_flush(void) {
+	uint8 result;
+
+	g_flushFailed = FALSE;
+
+	/* The TWI interrupt ends the write back */
+	while ((result = ECACHE_flushPoll()) == ECACHE_PENDING) {
+		IDLE_sleep();
+	}
+
+	return result;
+}
+
+/*
+ * Description :
+ * ECACHE_flush without waiting: start the next write back and return
+ * ECACHE_PENDING while pages are dirty, SUCCESS once all are written, or
+ * ERROR (once) if a write back failed, the page is dirty again.
+ */
+uint8 ECACHE_flushPoll(void) {
+	if (g_flushFailed == TRUE) {
+		g_flushFailed = FALSE;
+		return ERROR;
+	}
+	if (ECACHE_isDirty() == FALSE) {
+		return SUCCESS;
+	}
+
+	ECACHE_flushStep();
+	return ECACHE_PENDING;
+}
+
+/*
+ * Description :
+ * Drop the cached page holding u16addr with its unwritten changes, the next
+ * access reads it from the EEPROM again. Return ERROR, nothing dropped, while
+ * the page is being written back.
+ */
+uint8 ECACHE_discard(uint16 u16addr) {
+	uint8 line = ECACHE_find(u16addr & ~(EEPROM_PAGE_SIZE - 1));
+	uint8 sreg = SREG;
+
+	if (line == ECACHE_LINES) {
+		return SUCCESS;
+	}
+	if (g_flushing == line) {
+		return ERROR;
+	}
+
+	cli();
+	g_dirty &= ~(1 << line);
+	SREG = sreg;
+	g_lines[line].page = ECACHE_NO_PAGE;
+
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Return TRUE if a page is dirty or being written back.
+ */
+boolean ECACHE_isDirty(void) {
+	return (g_dirty != 0) || (g_flushing != ECACHE_NO_LINE);
+}
+
+/*
+ * Description :
+ * Copy the hit, miss and flush counters.
+ */
+void ECACHE_getStatistics(ECACHE_statistics *statistics) {
+	uint8 sreg = SREG;
+
+	/* flushes is counted in the TWI interrupt */
+	cli();
+	*statistics = g_statistics;
+	SREG = sreg;
+}
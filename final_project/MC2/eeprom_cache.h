@@ -0,0 +1,128 @@
+/******************************************************************************
+ *
+ * Module: EEPROM_CACHE
+ *
+ * File Name: eeprom_cache.h
+ *
+ * Description: Header file for the write-back RAM cache of the external EEPROM
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef EEPROM_CACHE_H_
+#define EEPROM_CACHE_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Cached EEPROM pages (EEPROM_PAGE_SIZE bytes each), at most 8. A line holds
+ * one page so a flush is a single page write.
+ */
+#ifndef ECACHE_LINES
+#define ECACHE_LINES					4
+#endif
+
+#if (ECACHE_LINES == 0) || (ECACHE_LINES > 8)
+#error "ECACHE_LINES must be between 1 and 8"
+#endif
+
+/* Result of the calls that never wait, besides SUCCESS and ERROR */
+#define ECACHE_PENDING					2
+
+typedef struct {
+	uint16 hits; /* Pages found in the cache */
+	uint16 misses; /* Pages read from the EEPROM */
+	uint16 flushes; /* Dirty pages written back */
+	uint16 evictions; /* Lines reused for another page */
+	uint16 clean_writes; /* Writes that changed nothing, no page made dirty */
+} ECACHE_statistics;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Empty the cache, call it after EEPROM_init.
+ */
+void ECACHE_init(void);
+
+/*
+ * Description :
+ * Copy length bytes, the pages not cached are read from the EEPROM first
+ * (read-through). Return SUCCESS or ERROR.
+ */
+uint8 ECACHE_read(uint16 u16addr, uint8 *data, uint16 length);
+
+/*
+ * Description :
+ * Copy length bytes into the cached pages and mark the pages that really
+ * changed dirty, the EEPROM is written later by ECACHE_flushStep or
+ * ECACHE_flush (write-back). Pages not cached are read first.
+ * Return SUCCESS or ERROR.
+ */
+uint8 ECACHE_write(uint16 u16addr, const uint8 *data, uint16 length);
+
+/*
+ * Description :
+ * Bring the page holding u16addr into the cache without waiting, for tasks
+ * that must not block: call it again until it returns SUCCESS, then
+ * ECACHE_read and ECACHE_write of that page do not touch the EEPROM.
+ * Return ECACHE_PENDING while a dirty victim is written back or the page is
+ * read in the background, ERROR if the EEPROM failed (the next call starts
+ * over).
+ */
+uint8 ECACHE_prefetch(uint16 u16addr);
+
+/*
+ * Description :
+ * Start writing back one dirty page in the background if the EEPROM is
+ * free, call it from the main loop (lazy flush). Never waits. After a failed
+ * write back it waits until ECACHE_flushPoll, ECACHE_flush or
+ * ECACHE_prefetch has reported the failure, so the writer can undo its
+ * change before the page is written again.
+ */
+void ECACHE_flushStep(void);
+
+/*
+ * Description :
+ * Write back all the dirty pages and wait until they are written.
+ * Return SUCCESS or ERROR.
+ */
+uint8 ECACHE_flush(void);
+
+/*
+ * Description :
+ * ECACHE_flush without waiting: start the next write back and return
+ * ECACHE_PENDING while pages are dirty, SUCCESS once all are written, or
+ * ERROR (once) if a write back failed, the page is dirty again.
+ */
+uint8 ECACHE_flushPoll(void);
+
+/*
+ * Description :
+ * Drop the cached page holding u16addr with its unwritten changes, the next
+ * access reads it from the EEPROM again. Return ERROR, nothing dropped, while
+ * the page is being written back.
+ */
+uint8 ECACHE_discard(uint16 u16addr);
+
+/*
+ * Description :
+ * Return TRUE if a page is dirty or being written back.
+ */
+boolean ECACHE_isDirty(void);
+
+/*
+ * Description :
+ * Copy the hit, miss and flush counters.
+ */
+void ECACHE_getStatistics(ECACHE_statistics *statistics);
+
+#endif /* EEPROM_CACHE_H_ */
@@ -11,76 +11,236 @@
  *******************************************************************************/
 #include "external_eeprom.h"
 #include "twi.h"
+#include "timer.h" /* Timer_micros to measure the write cycles */
+#include "idle.h" /* Sleep while the blocking calls wait */
+#include "micro_config.h" /* To use SREG and cli */
 
-void EEPROM_init(void) {
-	/* TWBR = 2 and address = 2 */
-	TWI_configuration config = { PRESCALE_1, 2, 2 };
-	TWI_init(&config);
+/* 24Cxx device address, A8 A9 A10 of the memory address select the block */
+#define EEPROM_DEVICE(u16addr) ((uint8) (0x50 | (((u16addr) & 0x0700) >> 8)))
+
+/*
+ * One operation at a time, split in chunks that never cross a page (write)
+ * or a read chunk (read): one TWI transaction per chunk, then for a write
+ * address-only probes until the chip ACKs again at the end of its write
+ * cycle (ACK polling) before the next chunk.
+ */
+static TWI_transaction g_transaction;
+static uint8 g_page[1 + EEPROM_PAGE_SIZE]; /* Memory address low byte + data */
+static uint16 g_address;
+static uint8 *g_data;
+static uint16 g_remaining;
+static uint8 g_chunk;
+static boolean g_writing;
+
+/* Address-only transaction of the ACK polling */
+static TWI_transaction g_probe;
+static uint8 g_probesLeft;
+static uint32 g_cycleStart;
+
+static EEPROM_statistics g_statistics = { 0, 0, 0, 0 };
+
+/* Callback of the running operation */
+static EEPROM_callback g_callBack = NULL;
+
+/* Set when the running operation ends, for the blocking calls */
+static volatile uint8 g_done;
+static volatile uint8 g_result;
+
+/* Bytes from u16addr up to the next multiple of limit (a power of two) */
+static uint8 EEPROM_chunk(uint16 u16addr, uint16 remaining, uint8 limit) {
+	uint8 chunk = limit - (u16addr & (limit - 1));
+
+	return (remaining < chunk) ? (uint8) remaining : chunk;
 }
 
-uint8 EEPROM_writeByte(uint16 u16addr, uint8 u8data) {
-	/* Send the Start Bit */
-	TWI_start();
-	if (TWI_getStatus() != TWI_START)
-		return ERROR;
+static void EEPROM_finish(uint8 result) {
+	g_result = result;
+	g_done = TRUE;
 
-	/* Send the device address, we need to get A8 A9 A10 address bits from the
-	 * memory location address and R/W=0 (write) */
-	TWI_writeByte((uint8) (0xA0 | ((u16addr & 0x0700) >> 7)));
-	if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-		return ERROR;
+	if (g_callBack != NULL) {
+		(*g_callBack)(result);
+	}
+}
 
-	/* Send the required memory location address */
-	TWI_writeByte((uint8) (u16addr));
-	if (TWI_getStatus() != TWI_MT_DATA_ACK)
-		return ERROR;
+/* Submit the transaction of the next chunk */
+static void EEPROM_nextChunk(void) {
+	uint8 i;
+
+	g_page[0] = (uint8) (g_address);
+	g_transaction.address = EEPROM_DEVICE(g_address);
+	g_transaction.write_data = g_page;
+
+	if (g_writing == TRUE) {
+		/* Memory location address then the page data, STOP starts the write cycle */
+		g_chunk = EEPROM_chunk(g_address, g_remaining, EEPROM_PAGE_SIZE);
+		for (i = 0; i < g_chunk; i++) {
+			g_page[1 + i] = g_data[i];
+		}
+		g_transaction.write_length = 1 + g_chunk;
+		g_transaction.read_data = NULL;
+		g_transaction.read_length = 0;
+	} else {
+		/* Memory location address, repeated START, then ACK all but the last */
+		g_chunk = EEPROM_chunk(g_address, g_remaining, EEPROM_READ_CHUNK);
+		g_transaction.write_length = 1;
+		g_transaction.read_data = g_data;
+		g_transaction.read_length = g_chunk;
+	}
+
+	if (TWI_submit(&g_transaction) == FALSE) {
+		EEPROM_finish(ERROR);
+	}
+}
+
+/* TWI callback of the ACK polling, runs in the TWI interrupt */
+static void EEPROM_probeDone(TWI_transaction *transaction) {
+	uint32 cycle;
+
+	if (transaction->result == TWI_ERROR_ADDRESS_NACK) {
+		/* Still writing, poll again right after this STOP */
+		if ((g_probesLeft != 0) && (TWI_submit(&g_probe) == TRUE)) {
+			g_probesLeft--;
+			g_statistics.polls++;
+		} else {
+			g_statistics.timeouts++;
+			EEPROM_finish(ERROR);
+		}
+		return;
+	}
+	if (transaction->result != TWI_DONE) {
+		EEPROM_finish(ERROR);
+		return;
+	}
+
+	/* ACK, the write cycle of the last page is over */
+	cycle = Timer_micros() - g_cycleStart;
+	g_statistics.last_cycle_us = (uint16) cycle;
+	if (g_statistics.last_cycle_us > g_statistics.max_cycle_us) {
+		g_statistics.max_cycle_us = g_statistics.last_cycle_us;
+	}
 
-	/* write byte to eeprom */
-	TWI_writeByte(u8data);
-	if (TWI_getStatus() != TWI_MT_DATA_ACK)
+	if (g_remaining != 0) {
+		EEPROM_nextChunk();
+	} else {
+		EEPROM_finish(SUCCESS);
+	}
+}
+
+/* TWI callback of every chunk, runs in the TWI interrupt */
+static void EEPROM_transactionDone(TWI_transaction *transaction) {
+	if (transaction->result != TWI_DONE) {
+		EEPROM_finish(ERROR);
+		return;
+	}
+
+	g_address += g_chunk;
+	g_data += g_chunk;
+	g_remaining -= g_chunk;
+
+	if (g_writing == TRUE) {
+		/* The STOP after this callback starts the write cycle */
+		g_cycleStart = Timer_micros();
+		g_probe.address = transaction->address;
+		g_probesLeft = EEPROM_POLL_LIMIT - 1;
+		g_statistics.polls++;
+		if (TWI_submit(&g_probe) == FALSE) {
+			EEPROM_finish(ERROR);
+		}
+	} else if (g_remaining != 0) {
+		EEPROM_nextChunk();
+	} else {
+		EEPROM_finish(SUCCESS);
+	}
+}
+
+static uint8 EEPROM_start(uint16 u16addr, uint8 *data, uint16 length,
+		boolean writing, EEPROM_callback callback) {
+	if ((EEPROM_isBusy() == TRUE) || (length == 0)) {
 		return ERROR;
+	}
 
-	/* Send the Stop Bit */
-	TWI_stop();
+	g_address = u16addr;
+	g_data = data;
+	g_remaining = length;
+	g_writing = writing;
+	g_transaction.callback = EEPROM_transactionDone;
+	g_callBack = callback;
+	g_done = FALSE;
 
+	EEPROM_nextChunk();
 	return SUCCESS;
 }
 
-uint8 EEPROM_readByte(uint16 u16addr, uint8 *u8data) {
-	/* Send the Start Bit */
-	TWI_start();
-	if (TWI_getStatus() != TWI_START)
+static uint8 EEPROM_wait(uint8 started) {
+	if (started == ERROR) {
 		return ERROR;
+	}
+	IDLE_waitUntil(&g_done);
+	return g_result;
+}
 
-	/* Send the device address, we need to get A8 A9 A10 address bits from the
-	 * memory location address and R/W=0 (write) */
-	TWI_writeByte((uint8) ((0xA0) | ((u16addr & 0x0700) >> 7)));
-	if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-		return ERROR;
+void EEPROM_init(void) {
+	/* TWBR = 2 and address = 2 */
+	TWI_configuration config = { PRESCALE_1, 2, 2 };
+	TWI_init(&config);
 
-	/* Send the required memory location address */
-	TWI_writeByte((uint8) (u16addr));
-	if (TWI_getStatus() != TWI_MT_DATA_ACK)
-		return ERROR;
+	/* START, SLA+W then STOP: ACKed once the write cycle is over */
+	g_probe.write_data = NULL;
+	g_probe.write_length = 0;
+	g_probe.read_data = NULL;
+	g_probe.read_length = 0;
+	g_probe.callback = EEPROM_probeDone;
 
-	/* Send the Repeated Start Bit */
-	TWI_start();
-	if (TWI_getStatus() != TWI_REP_START)
-		return ERROR;
+	g_done = TRUE;
+}
 
-	/* Send the device address, we need to get A8 A9 A10 address bits from the
-	 * memory location address and R/W=1 (Read) */
-	TWI_writeByte((uint8) ((0xA0) | ((u16addr & 0x0700) >> 7) | 1));
-	if (TWI_getStatus() != TWI_MT_SLA_R_ACK)
-		return ERROR;
+uint8 EEPROM_writeBlockAsync(uint16 u16addr, const uint8 *data, uint16 length,
+		EEPROM_callback callback) {
+	/* Only read while the pages are copied out */
+	return EEPROM_start(u16addr, (uint8*) data, length, TRUE, callback);
+}
 
-	/* Read Byte from Memory without send ACK */
-	*u8data = TWI_readByteWithNACK();
-	if (TWI_getStatus() != TWI_MR_DATA_NACK)
-		return ERROR;
+uint8 EEPROM_readBlockAsync(uint16 u16addr, uint8 *data, uint16 length,
+		EEPROM_callback callback) {
+	return EEPROM_start(u16addr, data, length, FALSE, callback);
+}
 
-	/* Send the Stop Bit */
-	TWI_stop();
+boolean EEPROM_isBusy(void) {
+	return (g_done == FALSE);
+}
 
-	return SUCCESS;
+uint8 EEPROM_writeBlock(uint16 u16addr, const uint8 *data, uint16 length) {
+	return EEPROM_wait(EEPROM_writeBlockAsync(u16addr, data, length, NULL));
+}
+
+uint8 EEPROM_readBlock(uint16 u16addr, uint8 *data, uint16 length) {
+	return EEPROM_wait(EEPROM_readBlockAsync(u16addr, data, length, NULL));
+}
+
+uint8 EEPROM_writeByte(uint16 u16addr, uint8 u8data) {
+	return EEPROM_writeBlock(u16addr, &u8data, 1);
+}
+
+uint8 EEPROM_readByte(uint16 u16addr, uint8 *u8data) {
+	return EEPROM_readBlock(u16addr, u8data, 1);
+}
+
+uint8 EEPROM_writeByteAsync(uint16 u16addr, uint8 u8data,
+		EEPROM_callback callback) {
+	/* The byte is copied to the page buffer before this returns */
+	return EEPROM_writeBlockAsync(u16addr, &u8data, 1, callback);
+}
+
+uint8 EEPROM_readByteAsync(uint16 u16addr, uint8 *u8data,
+		EEPROM_callback callback) {
+	return EEPROM_readBlockAsync(u16addr, u8data, 1, callback);
+}
+
+void EEPROM_getStatistics(EEPROM_statistics *statistics) {
+	uint8 sreg = SREG;
+
+	/* Updated by the TWI interrupt */
+	cli();
+	*statistics = g_statistics;
+	SREG = sreg;
 }
@@ -22,6 +22,33 @@
 #define ERROR 0
 #define SUCCESS 1
 
+/* 24Cxx page, a write must not cross it or it wraps to the page start */
+#define EEPROM_PAGE_SIZE 16
+
+/* Longest sequential read in one TWI transaction, a power of two up to 128 */
+#define EEPROM_READ_CHUNK 128
+
+/*
+ * After a page write the chip NACKs its address until the self-timed write
+ * cycle (5 ms max on the 24Cxx) is over, so it is polled with address-only
+ * transactions, each about 12 SCL periods, at most EEPROM_POLL_LIMIT times.
+ */
+#ifndef EEPROM_POLL_LIMIT
+#define EEPROM_POLL_LIMIT 100
+#endif
+
+/* Write cycles measured by the ACK polling */
+typedef struct {
+	uint16 last_cycle_us;
+	uint16 max_cycle_us;
+	uint16 polls; /* Address-only transactions sent */
+	uint16 timeouts; /* Writes that were still busy after EEPROM_POLL_LIMIT polls */
+} EEPROM_statistics;
+
+/* Called from the TWI interrupt when an asynchronous operation ends, with
+ * SUCCESS or ERROR */
+typedef void (*EEPROM_callback)(uint8 result);
+
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
@@ -31,5 +58,34 @@ void EEPROM_init(void);
 uint8 EEPROM_writeByte(uint16 u16addr,uint8 u8data);
 
 uint8 EEPROM_readByte(uint16 u16addr,uint8 *u8data);
+
+/* Write length bytes, one page write (and write cycle) per page touched,
+ * return when the chip ACKs after the last write cycle */
+uint8 EEPROM_writeBlock(uint16 u16addr, const uint8 *data, uint16 length);
+
+/* Read length bytes with sequential reads */
+uint8 EEPROM_readBlock(uint16 u16addr, uint8 *data, uint16 length);
+
+/* Start the operation in the background and return at once, ERROR if one
+ * is still running. The callback runs when a write has also finished its
+ * last write cycle, or when the read data is valid. data must stay valid
+ * until then */
+uint8 EEPROM_writeBlockAsync(uint16 u16addr, const uint8 *data, uint16 length,
+		EEPROM_callback callback);
+
+uint8 EEPROM_readBlockAsync(uint16 u16addr, uint8 *data, uint16 length,
+		EEPROM_callback callback);
+
+uint8 EEPROM_writeByteAsync(uint16 u16addr, uint8 u8data,
+		EEPROM_callback callback);
+
+uint8 EEPROM_readByteAsync(uint16 u16addr, uint8 *u8data,
+		EEPROM_callback callback);
+
+/* TRUE while an operation is running */
+boolean EEPROM_isBusy(void);
+
+/* Copy the measured write cycle times */
+void EEPROM_getStatistics(EEPROM_statistics *statistics);
  
 #endif /* EXTERNAL_EEPROM_H_ */
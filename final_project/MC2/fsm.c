@@ -0,0 +1,158 @@
+/******************************************************************************
+ *
+ * Module: FSM
+ *
+ * File Name: fsm.c
+ *
+ * Description: Source file for the table-driven finite state machine engine
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "fsm.h"
+#include "timer.h" /* To time stamp the trace */
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Run the entry or exit action of a state, read from flash.
+ */
+static void FSM_runStateAction(FSM_machine *fsm, const FSM_definition *def,
+		FSM_state state, boolean entry) {
+	FSM_state_actions actions;
+
+	if (state >= def->state_count) {
+		return;
+	}
+
+	memcpy_P(&actions, &def->states[state], sizeof(actions));
+	if ((entry == TRUE) && (actions.entry != NULL)) {
+		actions.entry(fsm);
+	} else if ((entry == FALSE) && (actions.exit != NULL)) {
+		actions.exit(fsm);
+	}
+}
+
+/*
+ * Description :
+ * Keep the transition in the trace ring, the oldest one is overwritten.
+ */
+static void FSM_record(FSM_machine *fsm, FSM_state from, FSM_event event,
+		FSM_state to) {
+#if FSM_TRACE_DEPTH
+	FSM_trace_entry *entry = &fsm->trace[fsm->trace_head];
+
+	entry->from = from;
+	entry->event = event;
+	entry->to = to;
+	entry->time_ms = (uint16) Timer_millis();
+
+	fsm->trace_head = (fsm->trace_head + 1) % FSM_TRACE_DEPTH;
+	if (fsm->trace_count < FSM_TRACE_DEPTH) {
+		fsm->trace_count++;
+	}
+#else
+	(void) fsm;
+	(void) from;
+	(void) event;
+	(void) to;
+#endif
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Bind the machine to its definition and enter the initial state.
+ */
+void FSM_init(FSM_machine *fsm, const FSM_definition *definition,
+		FSM_state initial) {
+	FSM_definition def;
+
+	memcpy_P(&def, definition, sizeof(def));
+
+	fsm->definition = definition;
+	fsm->state = initial;
+#if FSM_TRACE_DEPTH
+	fsm->trace_head = 0;
+	fsm->trace_count = 0;
+#endif
+
+	FSM_runStateAction(fsm, &def, initial, TRUE);
+}
+
+/*
+ * Description :
+ * Run the first transition matching the current state and the event:
+ * exit action, transition action, new state, entry action.
+ * Return FALSE if no transition takes the event, it is then ignored.
+ * Must not be called from the actions themselves.
+ */
+boolean FSM_dispatch(FSM_machine *fsm, FSM_event event) {
+	FSM_definition def;
+	FSM_transition row;
+	FSM_state from = fsm->state;
+	uint8 i;
+
+	memcpy_P(&def, fsm->definition, sizeof(def));
+
+	for (i = 0; i < def.transition_count; i++) {
+		memcpy_P(&row, &def.transitions[i], sizeof(row));
+
+		if (((row.state != from) && (row.state != FSM_ANY_STATE))
+				|| (row.event != event)) {
+			continue;
+		}
+		if ((row.guard != NULL) && (row.guard(fsm) == FALSE)) {
+			continue;
+		}
+
+		if (row.next == FSM_STAY) {
+			/* Internal transition, the state is neither left nor entered */
+			if (row.action != NULL) {
+				row.action(fsm);
+			}
+			FSM_record(fsm, from, event, from);
+		} else {
+			FSM_runStateAction(fsm, &def, from, FALSE);
+			if (row.action != NULL) {
+				row.action(fsm);
+			}
+			fsm->state = row.next;
+			FSM_record(fsm, from, event, row.next);
+			FSM_runStateAction(fsm, &def, row.next, TRUE);
+		}
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Description :
+ * Copy a transition taken by the machine, index 0 is the newest one.
+ * Return FALSE if fewer transitions are kept.
+ */
+boolean FSM_getTrace(const FSM_machine *fsm, uint8 index,
+		FSM_trace_entry *entry) {
+#if FSM_TRACE_DEPTH
+	if (index >= fsm->trace_count) {
+		return FALSE;
+	}
+
+	*entry = fsm->trace[(fsm->trace_head + FSM_TRACE_DEPTH - 1 - index)
+			% FSM_TRACE_DEPTH];
+	return TRUE;
+#else
+	(void) fsm;
+	(void) index;
+	(void) entry;
+	return FALSE;
+#endif
+}
@@ -0,0 +1,120 @@
+/******************************************************************************
+ *
+ * Module: FSM
+ *
+ * File Name: fsm.h
+ *
+ * Description: Header file for the table-driven finite state machine engine
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef FSM_H_
+#define FSM_H_
+
+#include "std_types.h"
+#include <avr/pgmspace.h> /* The tables are kept in flash */
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Transition source matching every state */
+#define FSM_ANY_STATE					0xFF
+
+/* Transition target of an internal transition: action only, no exit/entry */
+#define FSM_STAY						0xFF
+
+/* Transitions kept for FSM_getTrace, 0 turns tracing off */
+#ifndef FSM_TRACE_DEPTH
+#define FSM_TRACE_DEPTH					8
+#endif
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+typedef uint8 FSM_state;
+typedef uint8 FSM_event;
+
+typedef struct FSM_machine FSM_machine;
+
+/* A guard allows its transition when it returns TRUE */
+typedef boolean (*FSM_guard)(FSM_machine *fsm);
+typedef void (*FSM_action)(FSM_machine *fsm);
+
+/*
+ * One row of the transition table. The rows are tried in order and the
+ * first one matching the state and the event whose guard passes is taken.
+ * NULL guard always passes, NULL action does nothing.
+ */
+typedef struct {
+	FSM_state state;
+	FSM_event event;
+	FSM_guard guard;
+	FSM_action action;
+	FSM_state next;
+} FSM_transition;
+
+/* Entry and exit actions of one state, NULL for none */
+typedef struct {
+	FSM_action entry;
+	FSM_action exit;
+} FSM_state_actions;
+
+/* A machine type, all the tables are in flash (PROGMEM) */
+typedef struct {
+	const FSM_transition *transitions;
+	uint8 transition_count;
+	const FSM_state_actions *states; /* Indexed by FSM_state */
+	uint8 state_count;
+} FSM_definition;
+
+typedef struct {
+	FSM_state from;
+	FSM_event event;
+	FSM_state to;
+	uint16 time_ms; /* Low 16 bits of Timer_millis */
+} FSM_trace_entry;
+
+/* One instance of a machine type, in SRAM */
+struct FSM_machine {
+	const FSM_definition *definition; /* In flash */
+	FSM_state state;
+#if FSM_TRACE_DEPTH
+	FSM_trace_entry trace[FSM_TRACE_DEPTH];
+	uint8 trace_head;
+	uint8 trace_count;
+#endif
+};
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Bind the machine to its definition and enter the initial state.
+ */
+void FSM_init(FSM_machine *fsm, const FSM_definition *definition,
+		FSM_state initial);
+
+/*
+ * Description :
+ * Run the first transition matching the current state and the event:
+ * exit action, transition action, new state, entry action.
+ * Return FALSE if no transition takes the event, it is then ignored.
+ * Must not be called from the actions themselves.
+ */
+boolean FSM_dispatch(FSM_machine *fsm, FSM_event event);
+
+/*
+ * Description :
+ * Copy a transition taken by the machine, index 0 is the newest one.
+ * Return FALSE if fewer transitions are kept.
+ */
+boolean FSM_getTrace(const FSM_machine *fsm, uint8 index,
+		FSM_trace_entry *entry);
+
+#endif /* FSM_H_ */
@@ -0,0 +1,138 @@
+/******************************************************************************
+ *
+ * Module: IDLE
+ *
+ * File Name: idle.c
+ *
+ * Description: Source file for the idle manager, sleeps between interrupts
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "idle.h"
+#include "timer.h"
+#include "micro_config.h"
+#include "common_macros.h"
+#include <avr/sleep.h>
+
+/*******************************************************************************
+ *                      Global Variables (Private)                             *
+ *******************************************************************************/
+
+/* Timer_millis when the statistics were cleared */
+static uint32 g_startMs = 0;
+
+/* Whole milliseconds asleep, and the microseconds not yet making one */
+static uint32 g_asleepMs = 0;
+static uint16 g_asleepUs = 0;
+
+static uint32 g_wakeups = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Add one sleep period to the statistics, only called from the main loop.
+ */
+static void IDLE_account(uint32 slept_us) {
+	g_asleepMs += slept_us / 1000UL;
+	g_asleepUs += (uint16) (slept_us % 1000UL);
+	if (g_asleepUs >= 1000) {
+		g_asleepUs -= 1000;
+		g_asleepMs++;
+	}
+	g_wakeups++;
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Select SLEEP_MODE_IDLE and start the statistics. The timers, the UART and
+ * the TWI keep running in idle mode and any of their interrupts wakes the CPU.
+ */
+void IDLE_init(void) {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	IDLE_clearStatistics();
+}
+
+/*
+ * Description :
+ * Sleep until the next interrupt (at most one 1 ms tick), for polling loops.
+ * A condition that turns true between its check and the sleep is seen one
+ * tick late. Returns at once if the global interrupts are disabled.
+ */
+void IDLE_sleep(void) {
+	uint32 start;
+
+	/* Nothing could wake the CPU up */
+	if (BIT_IS_CLEAR(SREG, SREG_I)) {
+		return;
+	}
+
+	start = Timer_micros();
+	sleep_enable();
+	sleep_cpu();
+	sleep_disable();
+
+	/* The ISR that woke the CPU up already ran, it is counted as asleep */
+	IDLE_account(Timer_micros() - start);
+}
+
+/*
+ * Description :
+ * Sleep until an interrupt sets *flag to a non zero value. The flag is checked
+ * with interrupts disabled, so no wakeup can be missed.
+ */
+void IDLE_waitUntil(volatile uint8 *flag) {
+	uint32 start;
+	uint8 sreg = SREG;
+
+	if (BIT_IS_CLEAR(sreg, SREG_I)) {
+		return;
+	}
+
+	cli();
+	while (*flag == FALSE) {
+		start = Timer_micros();
+		sleep_enable();
+
+		/* The instruction after SEI runs before any pending interrupt, so an
+		 * interrupt that sets the flag now still wakes the SLEEP below */
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+
+		IDLE_account(Timer_micros() - start);
+	}
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Copy the asleep/awake time and the number of wakeups to stats.
+ */
+void IDLE_getStatistics(IDLE_statistics *stats) {
+	uint32 elapsed = Timer_millis() - g_startMs;
+
+	stats->asleep_ms = g_asleepMs;
+	stats->awake_ms = (elapsed > g_asleepMs) ? (elapsed - g_asleepMs) : 0;
+	stats->wakeups = g_wakeups;
+}
+
+/*
+ * Description :
+ * Restart the statistics from zero.
+ */
+void IDLE_clearStatistics(void) {
+	g_startMs = Timer_millis();
+	g_asleepMs = 0;
+	g_asleepUs = 0;
+	g_wakeups = 0;
+}
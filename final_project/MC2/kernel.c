@@ -0,0 +1,564 @@
+/******************************************************************************
+ *
+ * Module: KERNEL
+ *
+ * File Name: kernel.c
+ *
+ * Description: Source file for the optional preemptive priority kernel
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "kernel.h"
+
+#if KERNEL_ENABLED
+
+#include "timer.h"
+#include "idle.h"
+#include "common_macros.h"
+#include "micro_config.h"
+
+/*******************************************************************************
+ *                      Types and Global Variables (Private)                   *
+ *******************************************************************************/
+
+/* The idle task takes the last slot */
+#define KERNEL_IDLE_TASK				KERNEL_MAX_TASKS
+
+typedef struct {
+	uint8 *sp; /* Must stay first, the context switch saves SP here */
+	uint8 *stack;
+	uint16 stack_size;
+	void (*entry)(void);
+	KERNEL_semaphore *waiting; /* Semaphore a KERNEL_BLOCKED task waits for */
+	uint16 timeout; /* Ticks left, KERNEL_WAIT_FOREVER for none */
+	uint8 priority;
+	uint8 state;
+	boolean given; /* The semaphore was given to it before the timeout */
+} KERNEL_tcb;
+
+static KERNEL_tcb g_tasks[KERNEL_MAX_TASKS + 1];
+static uint8 g_taskCount = 0;
+static boolean g_started = FALSE;
+
+/* Running task and the one KERNEL_switch moves to, used by the assembly */
+KERNEL_tcb *volatile g_kernelCurrent = NULL;
+KERNEL_tcb *volatile g_kernelNext = NULL;
+
+/* TCNT0 when the last switch started */
+static uint8 g_switchStart;
+
+static KERNEL_switch_statistics g_switchStatistics = { 0, 0, 0 };
+
+/*******************************************************************************
+ *                      Context Switch                                         *
+ *******************************************************************************/
+
+/*
+ * Push r0, SREG (then disable the interrupts), r1 to r31 on the stack of the
+ * running task and save its SP in the TCB. r1 is cleared for the C code.
+ */
+#define KERNEL_SAVE_CONTEXT()						\
+	asm volatile (									\
+		"push r0					\n\t"		\
+		"in r0, __SREG__			\n\t"		\
+		"cli						\n\t"		\
+		"push r0					\n\t"		\
+		"push r1					\n\t"		\
+		"clr r1						\n\t"		\
+		"push r2					\n\t"		\
+		"push r3					\n\t"		\
+		"push r4					\n\t"		\
+		"push r5					\n\t"		\
+		"push r6					\n\t"		\
+		"push r7					\n\t"		\
+		"push r8					\n\t"		\
+		"push r9					\n\t"		\
+		"push r10					\n\t"		\
+		"push r11					\n\t"		\
+		"push r12					\n\t"		\
+		"push r13					\n\t"		\
+		"push r14					\n\t"		\
+		"push r15					\n\t"		\
+		"push r16					\n\t"		\
+		"push r17					\n\t"		\
+		"push r18					\n\t"		\
+		"push r19					\n\t"		\
+		"push r20					\n\t"		\
+		"push r21					\n\t"		\
+		"push r22					\n\t"		\
+		"push r23					\n\t"		\
+		"push r24					\n\t"		\
+		"push r25					\n\t"		\
+		"push r26					\n\t"		\
+		"push r27					\n\t"		\
+		"push r28					\n\t"		\
+		"push r29					\n\t"		\
+		"push r30					\n\t"		\
+		"push r31					\n\t"		\
+		"lds r26, g_kernelCurrent	\n\t"		\
+		"lds r27, g_kernelCurrent+1	\n\t"		\
+		"in r0, __SP_L__			\n\t"		\
+		"st x+, r0					\n\t"		\
+		"in r0, __SP_H__			\n\t"		\
+		"st x+, r0					\n\t"		\
+	)
+
+/* The reverse of KERNEL_SAVE_CONTEXT for the task in g_kernelCurrent */
+#define KERNEL_RESTORE_CONTEXT()					\
+	asm volatile (									\
+		"lds r26, g_kernelCurrent	\n\t"		\
+		"lds r27, g_kernelCurrent+1	\n\t"		\
+		"ld r28, x+					\n\t"		\
+		"out __SP_L__, r28			\n\t"		\
+		"ld r29, x+					\n\t"		\
+		"out __SP_H__, r29			\n\t"		\
+		"pop r31					\n\t"		\
+		"pop r30					\n\t"		\
+		"pop r29					\n\t"		\
+		"pop r28					\n\t"		\
+		"pop r27					\n\t"		\
+		"pop r26					\n\t"		\
+		"pop r25					\n\t"		\
+		"pop r24					\n\t"		\
+		"pop r23					\n\t"		\
+		"pop r22					\n\t"		\
+		"pop r21					\n\t"		\
+		"pop r20					\n\t"		\
+		"pop r19					\n\t"		\
+		"pop r18					\n\t"		\
+		"pop r17					\n\t"		\
+		"pop r16					\n\t"		\
+		"pop r15					\n\t"		\
+		"pop r14					\n\t"		\
+		"pop r13					\n\t"		\
+		"pop r12					\n\t"		\
+		"pop r11					\n\t"		\
+		"pop r10					\n\t"		\
+		"pop r9					\n\t"		\
+		"pop r8					\n\t"		\
+		"pop r7					\n\t"		\
+		"pop r6					\n\t"		\
+		"pop r5					\n\t"		\
+		"pop r4					\n\t"		\
+		"pop r3					\n\t"		\
+		"pop r2					\n\t"		\
+		"pop r1						\n\t"		\
+		"pop r0						\n\t"		\
+		"out __SREG__, r0			\n\t"		\
+		"pop r0						\n\t"		\
+	)
+
+/*
+ * Description :
+ * Save the running task, continue g_kernelNext. Called with interrupts
+ * disabled, from a task or from an ISR (the ISR frame simply stays on the
+ * stack of the task it interrupted until that task runs again).
+ */
+static void KERNEL_switch(void) __attribute__ ((naked, noinline));
+static void KERNEL_switch(void) {
+	KERNEL_SAVE_CONTEXT();
+	g_kernelCurrent = g_kernelNext;
+	KERNEL_RESTORE_CONTEXT();
+	asm volatile ("ret");
+}
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Highest priority ready task. The search starts after the running task so
+ * the ready tasks of the same priority take turns.
+ */
+static KERNEL_tcb *KERNEL_findNext(void) {
+	uint8 i;
+	uint8 index = (uint8) (g_kernelCurrent - g_tasks);
+	KERNEL_tcb *best = &g_tasks[KERNEL_IDLE_TASK];
+	KERNEL_tcb *task;
+
+	for (i = 0; i <= KERNEL_MAX_TASKS; i++) {
+		index = (index == KERNEL_MAX_TASKS) ? 0 : (index + 1);
+		if (index >= g_taskCount) {
+			continue;
+		}
+		task = &g_tasks[index];
+		if ((task->state == KERNEL_READY) && (task->priority > best->priority)) {
+			best = task;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Description :
+ * Account one context switch, runs first in the task switched to.
+ */
+static void KERNEL_measureSwitch(void) {
+	uint16 cycles = Timer_cyclesSince(g_switchStart);
+
+	g_switchStatistics.switches++;
+	g_switchStatistics.last_cycles = cycles;
+	if (cycles > g_switchStatistics.max_cycles) {
+		g_switchStatistics.max_cycles = cycles;
+	}
+}
+
+/*
+ * Description :
+ * Switch to the task that should run now, if it is not the running one.
+ * Called with interrupts disabled.
+ */
+static void KERNEL_reschedule(void) {
+	g_kernelNext = KERNEL_findNext();
+
+	if (g_kernelNext != g_kernelCurrent) {
+		g_switchStart = TCNT0;
+		KERNEL_switch();
+
+		/* Another task has run, this one has just been switched back to */
+		KERNEL_measureSwitch();
+	}
+}
+
+/*
+ * Description :
+ * First code of every task, the initial stack frame returns here.
+ */
+static void KERNEL_taskEntry(void) {
+	cli();
+	KERNEL_measureSwitch();
+	sei();
+
+	g_kernelCurrent->entry();
+
+	/* The task returned, it never runs again */
+	cli();
+	g_kernelCurrent->state = KERNEL_ENDED;
+	KERNEL_reschedule();
+}
+
+/*
+ * Description :
+ * Timer0 compare subscriber: count the delays and timeouts down and
+ * preempt the running task if a higher priority one is ready.
+ */
+static void KERNEL_tick(void) {
+	uint8 i;
+	KERNEL_tcb *task;
+
+	for (i = 0; i < g_taskCount; i++) {
+		task = &g_tasks[i];
+		if (((task->state == KERNEL_DELAYED) || (task->state == KERNEL_BLOCKED))
+				&& (task->timeout != KERNEL_WAIT_FOREVER)) {
+			task->timeout--;
+			if (task->timeout == 0) {
+				task->waiting = NULL;
+				task->state = KERNEL_READY;
+			}
+		}
+	}
+
+	KERNEL_reschedule();
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Add a task running entry on its own stack (painted with KERNEL_STACK_PAINT).
+ * The highest priority ready task runs, equal priorities share the CPU one
+ * tick each. Returns KERNEL_INVALID_TASK if there is no room.
+ */
+KERNEL_task_id KERNEL_createTask(void (*entry)(void), uint8 priority,
+		uint8 *stack, uint16 stack_size) {
+	KERNEL_tcb *task;
+	uint8 *top;
+	uint16 address = (uint16) KERNEL_taskEntry;
+	uint16 i;
+
+	if ((g_taskCount == KERNEL_MAX_TASKS) || (g_started == TRUE)
+			|| (stack_size < KERNEL_MIN_STACK) || (priority == 0)) {
+		return KERNEL_INVALID_TASK;
+	}
+
+	for (i = 0; i < stack_size; i++) {
+		stack[i] = KERNEL_STACK_PAINT;
+	}
+
+	/* Frame popped by KERNEL_RESTORE_CONTEXT then RET to KERNEL_taskEntry */
+	top = &stack[stack_size - 1];
+	*top-- = (uint8) (address & 0xFF);
+	*top-- = (uint8) (address >> 8);
+	*top-- = 0x00; /* r0 */
+	*top-- = 0x80; /* SREG, the task starts with interrupts enabled */
+	for (i = 1; i < 32; i++) {
+		*top-- = 0x00; /* r1 (must be zero) to r31 */
+	}
+
+	task = &g_tasks[g_taskCount];
+	task->sp = top;
+	task->stack = stack;
+	task->stack_size = stack_size;
+	task->entry = entry;
+	task->waiting = NULL;
+	task->timeout = KERNEL_WAIT_FOREVER;
+	task->priority = priority;
+	task->state = KERNEL_READY;
+
+	return g_taskCount++;
+}
+
+/*
+ * Description :
+ * Start the scheduler on the 1 ms Timer0 tick, never returns. The caller
+ * becomes the idle task (priority 0) that sleeps in idle mode. Call it last,
+ * after the other Timer0 compare subscribers, so they have all run when the
+ * kernel tick switches tasks.
+ */
+void KERNEL_start(void) {
+	KERNEL_tcb *idle = &g_tasks[KERNEL_IDLE_TASK];
+
+	cli();
+	idle->stack = NULL;
+	idle->stack_size = 0;
+	idle->priority = 0;
+	idle->state = KERNEL_READY;
+	idle->timeout = KERNEL_WAIT_FOREVER;
+	g_kernelCurrent = idle;
+	g_started = TRUE;
+
+	Timer_subscribe(TIMER0_COMP, KERNEL_tick, 1);
+	KERNEL_reschedule();
+	sei();
+
+	while (1) {
+		IDLE_sleep();
+	}
+}
+
+/*
+ * Description :
+ * Let the other ready tasks of the same priority run.
+ */
+void KERNEL_yield(void) {
+	uint8 sreg = SREG;
+
+	cli();
+	KERNEL_reschedule();
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Block the calling task for ticks milliseconds.
+ */
+void KERNEL_delay(uint16 ticks) {
+	uint8 sreg = SREG;
+
+	cli();
+	if ((ticks != 0) && (ticks != KERNEL_WAIT_FOREVER)) {
+		g_kernelCurrent->timeout = ticks;
+		g_kernelCurrent->state = KERNEL_DELAYED;
+	}
+	KERNEL_reschedule();
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Set the initial count of a semaphore.
+ */
+void KERNEL_semInit(KERNEL_semaphore *sem, uint8 count) {
+	sem->count = count;
+}
+
+/*
+ * Description :
+ * Take the semaphore, waiting at most timeout ticks (KERNEL_NO_WAIT,
+ * KERNEL_WAIT_FOREVER). Never waits when called from an ISR.
+ * Return FALSE on timeout.
+ */
+boolean KERNEL_semTake(KERNEL_semaphore *sem, uint16 timeout) {
+	boolean taken = FALSE;
+	uint8 sreg = SREG;
+
+	cli();
+	if (sem->count != 0) {
+		sem->count--;
+		taken = TRUE;
+	} else if ((timeout != KERNEL_NO_WAIT) && (g_started == TRUE)
+			&& BIT_IS_SET(sreg, SREG_I)
+			&& (g_kernelCurrent != &g_tasks[KERNEL_IDLE_TASK])) {
+		/* Interrupts were enabled so this is a task, not an ISR */
+		g_kernelCurrent->waiting = sem;
+		g_kernelCurrent->timeout = timeout;
+		g_kernelCurrent->given = FALSE;
+		g_kernelCurrent->state = KERNEL_BLOCKED;
+		KERNEL_reschedule();
+		taken = g_kernelCurrent->given;
+	}
+	SREG = sreg;
+
+	return taken;
+}
+
+/*
+ * Description :
+ * Give the semaphore to the highest priority task waiting for it. From a task
+ * it switches at once if that task has a higher priority, from an ISR the
+ * switch is left to the next tick.
+ */
+void KERNEL_semGive(KERNEL_semaphore *sem) {
+	uint8 i;
+	KERNEL_tcb *waiter = NULL;
+	uint8 sreg = SREG;
+
+	cli();
+	for (i = 0; i < g_taskCount; i++) {
+		if ((g_tasks[i].state == KERNEL_BLOCKED) && (g_tasks[i].waiting == sem)
+				&& ((waiter == NULL)
+						|| (g_tasks[i].priority > waiter->priority))) {
+			waiter = &g_tasks[i];
+		}
+	}
+
+	if (waiter != NULL) {
+		/* Handed over directly, the count stays at zero */
+		waiter->waiting = NULL;
+		waiter->given = TRUE;
+		waiter->state = KERNEL_READY;
+		if (BIT_IS_SET(sreg, SREG_I)
+				&& (waiter->priority > g_kernelCurrent->priority)) {
+			KERNEL_reschedule();
+		}
+	} else if (sem->count != 0xFF) {
+		sem->count++;
+	}
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Set up an empty queue on buffer (capacity * item_size bytes).
+ */
+void KERNEL_queueInit(KERNEL_queue *queue, uint8 *buffer, uint8 item_size,
+		uint8 capacity) {
+	queue->buffer = buffer;
+	queue->item_size = item_size;
+	queue->capacity = capacity;
+	queue->head = 0;
+	queue->count = 0;
+	KERNEL_semInit(&queue->items, 0);
+	KERNEL_semInit(&queue->spaces, capacity);
+}
+
+/*
+ * Description :
+ * Copy an item to the queue, waiting at most timeout ticks for room.
+ * Return FALSE on timeout.
+ */
+boolean KERNEL_queueSend(KERNEL_queue *queue, const void *item,
+		uint16 timeout) {
+	const uint8 *source = (const uint8*) item;
+	uint8 *target;
+	uint8 slot;
+	uint8 i;
+	uint8 sreg;
+
+	if (KERNEL_semTake(&queue->spaces, timeout) == FALSE) {
+		return FALSE;
+	}
+
+	sreg = SREG;
+	cli();
+	slot = queue->head + queue->count;
+	if (slot >= queue->capacity) {
+		slot -= queue->capacity;
+	}
+	target = &queue->buffer[(uint16) slot * queue->item_size];
+	for (i = 0; i < queue->item_size; i++) {
+		target[i] = source[i];
+	}
+	queue->count++;
+	SREG = sreg;
+
+	KERNEL_semGive(&queue->items);
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Copy the oldest item out of the queue, waiting at most timeout ticks for
+ * one. Return FALSE on timeout.
+ */
+boolean KERNEL_queueReceive(KERNEL_queue *queue, void *item, uint16 timeout) {
+	uint8 *target = (uint8*) item;
+	const uint8 *source;
+	uint8 i;
+	uint8 sreg;
+
+	if (KERNEL_semTake(&queue->items, timeout) == FALSE) {
+		return FALSE;
+	}
+
+	sreg = SREG;
+	cli();
+	source = &queue->buffer[(uint16) queue->head * queue->item_size];
+	for (i = 0; i < queue->item_size; i++) {
+		target[i] = source[i];
+	}
+	queue->head++;
+	if (queue->head == queue->capacity) {
+		queue->head = 0;
+	}
+	queue->count--;
+	SREG = sreg;
+
+	KERNEL_semGive(&queue->spaces);
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Copy the priority, state and stack use of a task.
+ */
+void KERNEL_getTaskInfo(KERNEL_task_id id, KERNEL_task_info *info) {
+	KERNEL_tcb *task;
+	uint16 untouched = 0;
+
+	if ((id != KERNEL_IDLE_TASK) && (id >= g_taskCount)) {
+		return;
+	}
+	task = &g_tasks[id];
+
+	/* The stack grows down, the paint left at the bottom was never used */
+	while ((untouched < task->stack_size)
+			&& (task->stack[untouched] == KERNEL_STACK_PAINT)) {
+		untouched++;
+	}
+
+	info->priority = task->priority;
+	info->state = (KERNEL_task_state) task->state;
+	info->stack_size = task->stack_size;
+	info->stack_high_water = task->stack_size - untouched;
+}
+
+/*
+ * Description :
+ * Copy the context switch count and duration.
+ */
+void KERNEL_getSwitchStatistics(KERNEL_switch_statistics *stats) {
+	uint8 sreg = SREG;
+
+	cli();
+	*stats = g_switchStatistics;
+	SREG = sreg;
+}
+
+#endif /* KERNEL_ENABLED */
@@ -0,0 +1,345 @@
+/******************************************************************************
+ *
+ * Module: PROTOCOL
+ *
+ * File Name: protocol.c
+ *
+ * Description: Source file for the framed HMI <-> CONTROL link protocol
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "protocol.h"
+#include "uart.h"
+#include "timer.h"
+#include <avr/pgmspace.h> /* To keep the CRC table in flash */
+
+/*******************************************************************************
+ *                      Global Variables (Private)                             *
+ *******************************************************************************/
+
+/* CRC-16/CCITT lookup table (poly 0x1021), kept in flash to save SRAM */
+static const uint16 g_crc16Table[256] PROGMEM = {
+		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+		0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+		0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+		0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+		0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+		0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+		0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+		0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+		0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+		0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+		0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+		0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+		0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+		0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+		0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+		0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+		0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+		0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+		0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+		0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+		0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+		0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+		0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+		0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+		0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+		0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+		0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+		0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+		0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+		0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+		0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+		0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+/* Escaped forms of PROTOCOL_SOF and PROTOCOL_ESC, queued as they are */
+static const uint8 g_escapedSof[2] = { PROTOCOL_ESC,
+		PROTOCOL_SOF ^ PROTOCOL_ESC_XOR };
+static const uint8 g_escapedEsc[2] = { PROTOCOL_ESC,
+		PROTOCOL_ESC ^ PROTOCOL_ESC_XOR };
+
+/* Parser used by PROTOCOL_receiveFrame and PROTOCOL_pollFrame */
+static PROTOCOL_parser g_parser = { WAIT_SOF, 0, PROTOCOL_CRC_SEED, 0, FALSE };
+
+/* Frame level link counters, only touched from the main loop */
+static uint16 g_framesReceived = 0;
+static uint16 g_framesRejected = 0;
+static uint16 g_retries = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Copy the frame the parser has just completed.
+ */
+static void PROTOCOL_copyFrame(PROTOCOL_frame *frame) {
+	uint8 i;
+
+	frame->type = g_parser.frame.type;
+	frame->length = g_parser.frame.length;
+	for (i = 0; i < g_parser.frame.length; i++) {
+		frame->payload[i] = g_parser.frame.payload[i];
+	}
+}
+
+/*
+ * Description :
+ * Queue length bytes escaped. The runs without a byte to escape go to the
+ * UART in one segment, which folds them into *crc (if crc is not NULL).
+ */
+static void PROTOCOL_sendEscaped(const uint8 *data, uint8 length, uint16 *crc) {
+	UART_segment segment;
+	uint8 i;
+
+	segment.data = data;
+	segment.length = 0;
+	for (i = 0; i < length; i++) {
+		if ((data[i] != PROTOCOL_SOF) && (data[i] != PROTOCOL_ESC)) {
+			segment.length++;
+			continue;
+		}
+
+		/* The run before it, then the escape pair, the CRC takes the raw byte */
+		UART_sendv(&segment, 1, (crc != NULL) ? PROTOCOL_crc16 : NULL, crc);
+		if (crc != NULL) {
+			*crc = PROTOCOL_crc16(*crc, data[i]);
+		}
+		segment.data = (data[i] == PROTOCOL_SOF) ? g_escapedSof : g_escapedEsc;
+		segment.length = 2;
+		UART_sendv(&segment, 1, NULL, NULL);
+
+		segment.data = &data[i + 1];
+		segment.length = 0;
+	}
+	UART_sendv(&segment, 1, (crc != NULL) ? PROTOCOL_crc16 : NULL, crc);
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Update a running CRC-16/CCITT with one byte using the lookup table.
+ */
+uint16 PROTOCOL_crc16(uint16 crc, uint8 data) {
+	return (crc << 8) ^ pgm_read_word(&g_crc16Table[(uint8) (crc >> 8) ^ data]);
+}
+
+/*
+ * Description :
+ * Build a frame around the payload and queue it on the UART.
+ */
+void PROTOCOL_sendFrame(uint8 type, const uint8 *payload, uint8 length) {
+	uint16 crc = PROTOCOL_CRC_SEED;
+	uint8 header[2];
+	uint8 trailer[2];
+
+	UART_sendByte(PROTOCOL_SOF);
+
+	/* The CRC is accumulated while TYPE, LENGTH and PAYLOAD are queued */
+	header[0] = type;
+	header[1] = length;
+	PROTOCOL_sendEscaped(header, 2, &crc);
+	PROTOCOL_sendEscaped(payload, length, &crc);
+
+	trailer[0] = (uint8) (crc >> 8);
+	trailer[1] = (uint8) crc;
+	PROTOCOL_sendEscaped(trailer, 2, NULL);
+}
+
+/*
+ * Description :
+ * Reset the parser so it hunts for the next start of frame.
+ */
+void PROTOCOL_parserInit(PROTOCOL_parser *parser) {
+	parser->state = WAIT_SOF;
+	parser->index = 0;
+	parser->crc = PROTOCOL_CRC_SEED;
+	parser->escaped = FALSE;
+}
+
+/*
+ * Description :
+ * Feed one received byte to the parser.
+ * Return TRUE when a complete frame with a matching CRC is in parser->frame.
+ */
+boolean PROTOCOL_parseByte(PROTOCOL_parser *parser, uint8 data) {
+
+	/*
+	 * A SOF is never escaped, it always starts a new frame: one cut short by
+	 * a lost byte or started by noise is dropped right here
+	 */
+	if (data == PROTOCOL_SOF) {
+		if (parser->state > WAIT_TYPE) {
+			g_framesRejected++;
+		}
+		PROTOCOL_parserInit(parser);
+		parser->state = WAIT_TYPE;
+		return FALSE;
+	}
+
+	/* Anything before a start of frame is line noise */
+	if (parser->state == WAIT_SOF) {
+		return FALSE;
+	}
+
+	if (data == PROTOCOL_ESC) {
+		parser->escaped = TRUE;
+		return FALSE;
+	}
+	if (parser->escaped == TRUE) {
+		parser->escaped = FALSE;
+		data ^= PROTOCOL_ESC_XOR;
+	}
+
+	switch (parser->state) {
+
+	case WAIT_TYPE:
+		parser->frame.type = data;
+		parser->crc = PROTOCOL_crc16(parser->crc, data);
+		parser->state = WAIT_LENGTH;
+		break;
+
+	case WAIT_LENGTH:
+		if (data > PROTOCOL_MAX_PAYLOAD) {
+			/* Impossible length, wait for the next start of frame */
+			g_framesRejected++;
+			PROTOCOL_parserInit(parser);
+			break;
+		}
+		parser->frame.length = data;
+		parser->crc = PROTOCOL_crc16(parser->crc, data);
+		parser->state = (data == 0) ? WAIT_CRC_HIGH : WAIT_PAYLOAD;
+		break;
+
+	case WAIT_PAYLOAD:
+		parser->frame.payload[parser->index++] = data;
+		parser->crc = PROTOCOL_crc16(parser->crc, data);
+		if (parser->index == parser->frame.length) {
+			parser->state = WAIT_CRC_HIGH;
+		}
+		break;
+
+	case WAIT_CRC_HIGH:
+		parser->received_crc = (uint16) data << 8;
+		parser->state = WAIT_CRC_LOW;
+		break;
+
+	case WAIT_CRC_LOW:
+		parser->received_crc |= data;
+		parser->state = WAIT_SOF;
+		if (parser->received_crc == parser->crc) {
+			g_framesReceived++;
+			return TRUE;
+		}
+		/* Corrupted frame, drop it and hunt for the next start of frame */
+		g_framesRejected++;
+		break;
+
+	default:
+		break;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Description :
+ * Wait at most timeout_ms (1 ms Timer0 tick) for a valid frame and copy it
+ * to frame. Return UART_OK, UART_TIMEOUT, or the UART receive error that
+ * broke the frame in progress (the caller may retry right away).
+ */
+UART_status PROTOCOL_receiveFrame(PROTOCOL_frame *frame, uint16 timeout_ms) {
+	UART_status status;
+	uint8 data;
+	uint32 start = Timer_millis();
+	uint32 elapsed = 0;
+
+	/*
+	 * One deadline for the whole frame: each byte only gets the time left,
+	 * so bytes trickling in just before their own timeout can not extend it
+	 */
+	do {
+		status = UART_receiveByteTimeout(&data,
+				(uint16) (timeout_ms - elapsed));
+		if (status != UART_OK) {
+			/* A lost or corrupted byte breaks the frame in progress */
+			PROTOCOL_parserInit(&g_parser);
+			return status;
+		}
+
+		if (PROTOCOL_parseByte(&g_parser, data) == TRUE) {
+			PROTOCOL_copyFrame(frame);
+			return UART_OK;
+		}
+
+		elapsed = Timer_millis() - start;
+	} while (elapsed < timeout_ms);
+
+	PROTOCOL_parserInit(&g_parser);
+	return UART_TIMEOUT;
+}
+
+/*
+ * Description :
+ * Feed the bytes already received to the parser without waiting.
+ * Return TRUE and copy the frame as soon as one is complete, the bytes after
+ * it stay in the Rx buffer for the next call. A UART receive error drops the
+ * frame in progress.
+ */
+boolean PROTOCOL_pollFrame(PROTOCOL_frame *frame) {
+	uint8 data;
+
+	while (1) {
+		if (UART_read(&data, 1) == 0) {
+			/* Nothing left, or UART_read stopped at a receive error */
+			if (UART_takeRxStatus() == UART_OK) {
+				return FALSE;
+			}
+			/* The error is where the frame in progress broke, the bytes after it come next */
+			PROTOCOL_parserInit(&g_parser);
+			continue;
+		}
+
+		if (PROTOCOL_parseByte(&g_parser, data) == TRUE) {
+			PROTOCOL_copyFrame(frame);
+			return TRUE;
+		}
+	}
+}
+
+/*
+ * Description :
+ * Count a request sent again because the previous one got no answer.
+ */
+void PROTOCOL_countRetry(void) {
+	g_retries++;
+}
+
+/*
+ * Description :
+ * Copy the link health counters.
+ */
+void PROTOCOL_getLinkStatistics(PROTOCOL_link_statistics *stats) {
+	UART_getErrorCounters(&stats->uart);
+	stats->frames_received = g_framesReceived;
+	stats->frames_rejected = g_framesRejected;
+	stats->retries = g_retries;
+}
+
+/*
+ * Description :
+ * Reset the link health counters, including the UART error counters.
+ */
+void PROTOCOL_clearLinkStatistics(void) {
+	UART_clearErrorCounters();
+	g_framesReceived = 0;
+	g_framesRejected = 0;
+	g_retries = 0;
+}
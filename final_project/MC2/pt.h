@@ -0,0 +1,96 @@
+/******************************************************************************
+ *
+ * Module: PT
+ *
+ * File Name: pt.h
+ *
+ * Description: Stackless coroutines (protothreads) for cooperative tasks
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef PT_H_
+#define PT_H_
+
+#include "std_types.h"
+#include "timer.h" /* Timer_millis for PT_AWAIT_MS */
+
+/*
+ * A task is a function taking its PT_thread and returning one of the PT_xxx
+ * values below, its body is written between PT_BEGIN and PT_END. At each
+ * PT_AWAIT or PT_YIELD the function returns and the next call resumes right
+ * after it, so all the tasks share the one C stack.
+ *
+ * The resume point is a switch case label, so:
+ * - local variables are lost across PT_AWAIT/PT_YIELD, keep them static,
+ * - the task body must not use a switch statement of its own around them,
+ * - only one PT_AWAIT/PT_YIELD per source line.
+ */
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+#define PT_WAITING						0
+#define PT_YIELDED						1
+#define PT_ENDED						2
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+/* Four bytes of state per task */
+typedef struct {
+	uint16 lc;			/* Resume point, the __LINE__ of the last wait */
+	uint16 start_ms;	/* Low 16 bits of Timer_millis for PT_AWAIT_MS */
+} PT_thread;
+
+/*******************************************************************************
+ *                                 Macros                                      *
+ *******************************************************************************/
+
+/* Start the task from its first line on the next call */
+#define PT_INIT(pt)						((pt)->lc = 0)
+
+#define PT_BEGIN(pt)					\
+	{ uint8 pt_yielded = TRUE; (void) pt_yielded; switch ((pt)->lc) { case 0:
+
+#define PT_END(pt)						\
+	} pt_yielded = FALSE; PT_INIT(pt); return PT_ENDED; }
+
+/* Return until cond is true, cond is evaluated again at every call */
+#define PT_AWAIT(pt, cond)				\
+	do {								\
+		(pt)->lc = __LINE__; case __LINE__:	\
+		if (!(cond)) {					\
+			return PT_WAITING;			\
+		}								\
+	} while (0)
+
+/* Let the other tasks run once, then go on */
+#define PT_YIELD(pt)					\
+	do {								\
+		pt_yielded = FALSE;				\
+		(pt)->lc = __LINE__; case __LINE__:	\
+		if (pt_yielded == FALSE) {		\
+			return PT_YIELDED;			\
+		}								\
+	} while (0)
+
+/* Return until ms milliseconds (up to 65535) have passed */
+#define PT_AWAIT_MS(pt, ms)				\
+	do {								\
+		(pt)->start_ms = (uint16) Timer_millis();	\
+		PT_AWAIT(pt, (uint16) ((uint16) Timer_millis() - (pt)->start_ms)	\
+				>= (uint16) (ms));		\
+	} while (0)
+
+/* Restart the task from PT_BEGIN on the next call */
+#define PT_RESTART(pt)					\
+	do {								\
+		PT_INIT(pt);					\
+		return PT_WAITING;				\
+	} while (0)
+
+#endif /* PT_H_ */
@@ -0,0 +1,229 @@
+/******************************************************************************
+ *
+ * Module: SW_TIMER
+ *
+ * File Name: sw_timer.c
+ *
+ * Description: Source file for the software timer service driven by Timer0
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "sw_timer.h"
+#include "micro_config.h"
+
+/*******************************************************************************
+ *                      Types and Global Variables (Private)                   *
+ *******************************************************************************/
+
+/* Marks the end of a slot list */
+#define SW_TIMER_NONE					0xFF
+
+typedef struct {
+	void (*callback)(void); /* NULL when the timer is free */
+	uint32 period; /* reload value in ticks, 0 for one-shot */
+	uint32 rounds; /* wheel turns left after the previous timer in the slot */
+	uint8 slot; /* wheel slot the timer is linked in */
+	uint8 next; /* next timer in the same slot */
+	uint8 prev; /* previous timer in the same slot */
+	boolean due; /* expired, unlinked until its callback runs in this tick */
+} SW_timer;
+
+static SW_timer g_timers[SW_TIMER_MAX];
+
+/* First timer of each slot */
+static uint8 g_wheel[SW_TIMER_WHEEL_SIZE];
+
+/* Slot handled by the next tick */
+static uint8 g_cursor = 0;
+
+/* Subscription of SWTIMER_tick to the Timer0 compare interrupt */
+static timer_subscriber_id g_tickSubscriber = TIMER_NO_SUBSCRIBER;
+
+/*******************************************************************************
+ *                      Functions Definitions (Private)                        *
+ *******************************************************************************/
+
+/*
+ * Link a timer in the slot that the cursor reaches after ticks ticks. A slot
+ * is kept in expiry order, each timer holding its turns after the previous
+ * one, so a tick only looks at the head of the slot.
+ * Must be called with interrupts disabled or from the ISR.
+ */
+static void SWTIMER_insert(uint8 id, uint32 ticks) {
+	SW_timer *timer = &g_timers[id];
+	uint8 slot = (g_cursor + (uint8) ((ticks - 1) & (SW_TIMER_WHEEL_SIZE - 1)))
+			& (SW_TIMER_WHEEL_SIZE - 1);
+	uint32 rounds = (ticks - 1) / SW_TIMER_WHEEL_SIZE;
+	uint8 prev = SW_TIMER_NONE;
+	uint8 next = g_wheel[slot];
+
+	/* Timers expiring in the same turn keep the order they were started in */
+	while ((next != SW_TIMER_NONE) && (g_timers[next].rounds <= rounds)) {
+		rounds -= g_timers[next].rounds;
+		prev = next;
+		next = g_timers[next].next;
+	}
+
+	timer->rounds = rounds;
+	timer->slot = slot;
+	timer->prev = prev;
+	timer->next = next;
+	if (next != SW_TIMER_NONE) {
+		g_timers[next].rounds -= rounds;
+		g_timers[next].prev = id;
+	}
+	if (prev != SW_TIMER_NONE) {
+		g_timers[prev].next = id;
+	} else {
+		g_wheel[slot] = id;
+	}
+}
+
+/*
+ * Unlink a timer from its slot.
+ * Must be called with interrupts disabled or from the ISR.
+ */
+static void SWTIMER_unlink(uint8 id) {
+	SW_timer *timer = &g_timers[id];
+
+	if (timer->prev != SW_TIMER_NONE) {
+		g_timers[timer->prev].next = timer->next;
+	} else {
+		g_wheel[timer->slot] = timer->next;
+	}
+	if (timer->next != SW_TIMER_NONE) {
+		g_timers[timer->next].rounds += timer->rounds;
+		g_timers[timer->next].prev = timer->prev;
+	}
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Stop all the timers and hook the service to the Timer0 compare interrupt.
+ * Timer0 itself is started by Timer_Init as the 1 ms tick.
+ */
+void SWTIMER_init(void) {
+	uint8 i;
+
+	for (i = 0; i < SW_TIMER_MAX; i++) {
+		g_timers[i].callback = NULL;
+	}
+	for (i = 0; i < SW_TIMER_WHEEL_SIZE; i++) {
+		g_wheel[i] = SW_TIMER_NONE;
+	}
+	g_cursor = 0;
+
+	/* Share the 1 ms tick with the other Timer0 compare subscribers */
+	if (g_tickSubscriber != TIMER_NO_SUBSCRIBER) {
+		Timer_unsubscribe(g_tickSubscriber);
+	}
+	g_tickSubscriber = Timer_subscribe(TIMER0_COMP, SWTIMER_tick, 1);
+}
+
+/*
+ * Description :
+ * Start a timer that calls callback after ticks ticks (at least 1), then
+ * every period ticks, or only once if period is 0.
+ * The callback runs in the Timer0 interrupt so it must be short.
+ * Return the timer id or SW_TIMER_INVALID if no timer is free.
+ */
+SW_timer_id SWTIMER_start(uint32 ticks, uint32 period, void (*callback)(void)) {
+	uint8 id;
+	uint8 sreg = SREG;
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	cli();
+	for (id = 0; id < SW_TIMER_MAX; id++) {
+		if (g_timers[id].callback == NULL) {
+			g_timers[id].callback = callback;
+			g_timers[id].period = period;
+			g_timers[id].due = FALSE;
+			SWTIMER_insert(id, ticks);
+			break;
+		}
+	}
+	SREG = sreg;
+
+	return (id < SW_TIMER_MAX) ? id : SW_TIMER_INVALID;
+}
+
+/*
+ * Description :
+ * Stop a running timer, its callback will not be called anymore.
+ */
+void SWTIMER_cancel(SW_timer_id id) {
+	uint8 sreg = SREG;
+
+	if (id >= SW_TIMER_MAX) {
+		return;
+	}
+
+	cli();
+	if (g_timers[id].callback != NULL) {
+		/* A due timer is already unlinked, its callback is just skipped */
+		if (g_timers[id].due == TRUE) {
+			g_timers[id].due = FALSE;
+		} else {
+			SWTIMER_unlink(id);
+		}
+		g_timers[id].callback = NULL;
+	}
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Advance the wheel by one tick, called from the Timer0 compare interrupt.
+ */
+void SWTIMER_tick(void) {
+	uint8 slot = g_cursor;
+	uint8 id = g_wheel[slot];
+	uint8 count = 0;
+	uint8 i;
+	uint8 expired[SW_TIMER_MAX];
+	void (*callback)(void);
+
+	/* Move the cursor first so periodic timers are re-armed relative to it */
+	g_cursor = (g_cursor + 1) & (SW_TIMER_WHEEL_SIZE - 1);
+
+	/* The timers at the head with no turn left expire, the next one waits */
+	while ((id != SW_TIMER_NONE) && (g_timers[id].rounds == 0)) {
+		SWTIMER_unlink(id);
+		g_timers[id].due = TRUE;
+		expired[count++] = id;
+		id = g_wheel[slot];
+	}
+	if (id != SW_TIMER_NONE) {
+		g_timers[id].rounds--;
+	}
+
+	/*
+	 * A callback may start or cancel timers, so each timer is checked right
+	 * before its own callback: one cancelled by an earlier callback is skipped
+	 */
+	for (i = 0; i < count; i++) {
+		id = expired[i];
+		if (g_timers[id].due == FALSE) {
+			continue;
+		}
+		g_timers[id].due = FALSE;
+		callback = g_timers[id].callback;
+
+		if (g_timers[id].period != 0) {
+			SWTIMER_insert(id, g_timers[id].period);
+		} else {
+			g_timers[id].callback = NULL;
+		}
+
+		callback();
+	}
+}
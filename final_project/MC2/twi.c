@@ -13,8 +13,141 @@
 #include "twi.h"
 
 #include "common_macros.h"
+#include "micro_config.h" /* To use the ISR macro */
+#include "spsc.h"
 #include <avr/io.h>
 
+/* TWCR values of the interrupt driven master, TWINT set clears the flag */
+#define TWI_CONTINUE ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+
+/*
+ * Pending transactions, the head one is running. The submits are serialized
+ * by masking the interrupts, the TWI interrupt is the only consumer.
+ */
+SPSC_QUEUE(TWI_queue, TWI_transaction*, TWI_QUEUE_SIZE)
+
+static TWI_queue g_queue;
+
+/* Running transaction, NULL when the bus is idle */
+static TWI_transaction *volatile g_current = NULL;
+
+/* Bytes written or read in the current phase of g_current */
+static uint8 g_index;
+
+/*
+ * Wait until the STOP requested last is on the bus. TWSTO is cleared by the
+ * hardware once it is sent, a few SCL periods, and no interrupt tells it.
+ * A START requested before that can be missed or end in a bus error.
+ */
+static void TWI_waitStop(void) {
+	while (BIT_IS_SET(TWCR, TWSTO))
+		;
+}
+
+/*
+ * End the running transaction, report it and start the next queued one.
+ * A STOP is sent unless the bus was lost to another master.
+ */
+static void TWI_finish(TWI_result result, uint8 status, boolean stop) {
+	TWI_transaction *transaction;
+	TWI_transaction *next;
+
+	TWI_queue_pop(&g_queue, &transaction);
+	transaction->status = status;
+	transaction->result = result;
+
+	/* The callback may queue a follow up, e.g. the next page to write */
+	if (transaction->callback != NULL) {
+		(*transaction->callback)(transaction);
+	}
+
+	if (stop == TRUE) {
+		TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+		TWI_waitStop();
+	}
+	if (TWI_queue_peek(&g_queue, &next) == TRUE) {
+		/* After a lost arbitration the START waits for the bus to be free */
+		g_current = next;
+		TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+	} else {
+		g_current = NULL;
+		if (stop == FALSE) {
+			TWCR = (1 << TWINT) | (1 << TWEN);
+		}
+	}
+}
+
+/* One bus event of the running transaction per interrupt */
+ISR(TWI_vect) {
+	TWI_transaction *transaction = g_current;
+	uint8 status = TWSR & 0xF8;
+
+	switch (status) {
+	case TWI_START:
+	case TWI_REP_START:
+		g_index = 0;
+		/* The repeated START is only sent to turn to the read phase */
+		if ((status == TWI_START)
+				&& ((transaction->write_length != 0)
+						|| (transaction->read_length == 0))) {
+			TWDR = transaction->address << 1;
+		} else {
+			TWDR = (transaction->address << 1) | 1;
+		}
+		TWCR = TWI_CONTINUE;
+		break;
+
+	case TWI_MT_SLA_W_ACK:
+	case TWI_MT_DATA_ACK:
+		if (g_index < transaction->write_length) {
+			TWDR = transaction->write_data[g_index];
+			g_index++;
+			TWCR = TWI_CONTINUE;
+		} else if (transaction->read_length != 0) {
+			TWCR = TWI_CONTINUE | (1 << TWSTA);
+		} else {
+			TWI_finish(TWI_DONE, status, TRUE);
+		}
+		break;
+
+	case TWI_MR_DATA_ACK:
+		transaction->read_data[g_index] = TWDR;
+		g_index++;
+		/* no break */
+	case TWI_MT_SLA_R_ACK:
+		/* ACK every byte but the last one */
+		if ((g_index + 1) < transaction->read_length) {
+			TWCR = TWI_CONTINUE | (1 << TWEA);
+		} else {
+			TWCR = TWI_CONTINUE;
+		}
+		break;
+
+	case TWI_MR_DATA_NACK:
+		transaction->read_data[g_index] = TWDR;
+		TWI_finish(TWI_DONE, status, TRUE);
+		break;
+
+	case TWI_MT_SLA_W_NACK:
+	case TWI_MT_SLA_R_NACK:
+		TWI_finish(TWI_ERROR_ADDRESS_NACK, status, TRUE);
+		break;
+
+	case TWI_MT_DATA_NACK:
+		TWI_finish(TWI_ERROR_DATA_NACK, status, TRUE);
+		break;
+
+	case TWI_ARB_LOST:
+		TWI_finish(TWI_ERROR_ARBITRATION, status, FALSE);
+		break;
+
+	default:
+		/* A STOP request also recovers from a bus error without sending it */
+		TWI_finish(TWI_ERROR_BUS, status, TRUE);
+		break;
+	}
+}
+
 void TWI_init(const TWI_configuration *config_ptr) {
 
 	/* Bits 7..0  TWI Bit Rate Register */
@@ -26,6 +159,10 @@ void TWI_init(const TWI_configuration *config_ptr) {
 	/* Slave address from bit 1 to bit 7 */
 	TWAR = (~0X01 & config_ptr->slave_address);
 
+	/* Nothing queued yet */
+	TWI_queue_init(&g_queue);
+	g_current = NULL;
+
 	/* Enable TWI */
 	TWCR = (1 << TWEN);
 }
@@ -98,3 +235,26 @@ uint8 TWI_getStatus(void) {
 	status = TWSR & 0xF8;
 	return status;
 }
+
+boolean TWI_submit(TWI_transaction *transaction) {
+	boolean queued;
+	uint8 sreg = SREG;
+
+	transaction->result = TWI_PENDING;
+
+	cli();
+	queued = TWI_queue_push(&g_queue, &transaction);
+	if ((queued == TRUE) && (g_current == NULL)) {
+		/* The bus is idle, start once the last STOP is out */
+		g_current = transaction;
+		TWI_waitStop();
+		TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+	}
+	SREG = sreg;
+
+	return queued;
+}
+
+boolean TWI_isIdle(void) {
+	return (g_current == NULL);
+}
@@ -29,6 +29,39 @@ typedef struct {
 
 } TWI_configuration;
 
+/* Outcome of a queued transaction */
+typedef enum {
+	TWI_PENDING, /* queued or running */
+	TWI_DONE,
+	TWI_ERROR_ADDRESS_NACK, /* no slave answered, e.g. an EEPROM busy writing */
+	TWI_ERROR_DATA_NACK, /* the slave refused a byte */
+	TWI_ERROR_ARBITRATION, /* another master took the bus */
+	TWI_ERROR_BUS /* illegal START or STOP on the bus */
+} TWI_result;
+
+typedef struct TWI_transaction TWI_transaction;
+
+/* Called from the TWI interrupt when a transaction ends, NULL for none */
+typedef void (*TWI_callback)(TWI_transaction *transaction);
+
+/*
+ * Write then read transaction run in the background by the TWI interrupt:
+ * START, SLA+W and write_data, then (repeated) START, SLA+R and read_data,
+ * then STOP. Either part can be empty, with both empty only the address is
+ * sent (to poll for an ACK). The caller owns it and must not touch it until
+ * result leaves TWI_PENDING.
+ */
+struct TWI_transaction {
+	uint8 address; /* 7-bit slave address */
+	const uint8 *write_data;
+	uint8 write_length;
+	uint8 *read_data;
+	uint8 read_length;
+	TWI_callback callback;
+	volatile TWI_result result;
+	volatile uint8 status; /* TWI_getStatus() value that ended it */
+};
+
 /*******************************************************************************
  *                      Preprocessor Macros                                    *
  *******************************************************************************/
@@ -41,6 +74,14 @@ typedef struct {
 #define TWI_MT_DATA_ACK   0x28 /* Master transmit data and ACK has been received from Slave. */
 #define TWI_MR_DATA_ACK   0x50 /* Master received data and send ACK to slave. */
 #define TWI_MR_DATA_NACK  0x58 /* Master received data but doesn't send ACK to slave. */
+#define TWI_MT_SLA_W_NACK 0x20 /* Slave address + Write request sent, NACK received. */
+#define TWI_MT_DATA_NACK  0x30 /* Master transmit data and NACK has been received from Slave. */
+#define TWI_ARB_LOST      0x38 /* Arbitration lost to another master. */
+#define TWI_MT_SLA_R_NACK 0x48 /* Slave address + Read request sent, NACK received. */
+#define TWI_BUS_ERROR     0x00 /* Illegal START or STOP condition. */
+
+/* Transactions waiting for the bus, a power of two up to 128 (spsc.h) */
+#define TWI_QUEUE_SIZE    4
 
 /*******************************************************************************
  *                      Functions Prototypes                                   *
@@ -60,4 +101,19 @@ uint8 TWI_readByteWithNACK(void);
 
 uint8 TWI_getStatus(void);
 
+/*
+ * Description :
+ * Queue a transaction, the TWI interrupt runs it as soon as the bus is free
+ * and calls its callback at the end. Do not use the polling functions above
+ * while transactions are queued.
+ * Return FALSE if the queue is full.
+ */
+boolean TWI_submit(TWI_transaction *transaction);
+
+/*
+ * Description :
+ * Return TRUE if no transaction is queued or running.
+ */
+boolean TWI_isIdle(void);
+
 #endif /* TWI_H_ */
@@ -0,0 +1,408 @@
+/******************************************************************************
+ *
+ * Module: CRED_STORE host test
+ *
+ * File Name: powerfail_test.c
+ *
+ * Description: Cut the power after every byte the credential store writes
+ * and fail every EEPROM write once, then check that the value read back
+ * after a reboot is always the old or the new one
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "cred_store.h"
+#include "eeprom_cache.h"
+#include "idle.h"
+#include "timer.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                      RAM EEPROM                                             *
+ *******************************************************************************/
+
+#define TEST_EEPROM_SIZE	2048
+
+#define TEST_NO_LIMIT		(-1L)
+
+static uint8 g_memory[TEST_EEPROM_SIZE];
+
+/*
+ * Operation running in the background, it ends on the next TEST_tick (the
+ * TWI interrupt). A write is programmed byte by byte only then, during its
+ * write cycle.
+ */
+static boolean g_busy = FALSE;
+static boolean g_writing;
+static uint16 g_address;
+static uint16 g_length;
+static uint8 g_page[TEST_EEPROM_SIZE];
+static uint8 *g_readData;
+static EEPROM_callback g_callback;
+
+/* Bytes programmed before the power is cut, TEST_NO_LIMIT to never cut */
+static long g_budget = TEST_NO_LIMIT;
+
+/* Value left in the byte being programmed when the power goes */
+static uint8 g_garbage;
+
+/*
+ * The chip programs a page in one write cycle, in no given byte order: it is
+ * programmed first to last byte, or last to first when set
+ */
+static boolean g_reverse = FALSE;
+
+static jmp_buf g_powerCut;
+
+/* Write operations started, and the one reported failed (TEST_NO_LIMIT: none) */
+static long g_writes = 0;
+static long g_failWrite = TEST_NO_LIMIT;
+
+/* The failed write is still programmed when set, else not at all */
+static boolean g_failProgrammed;
+
+static void TEST_program(uint16 address, const uint8 *data, uint16 length) {
+	uint16 i;
+	uint16 j;
+
+	for (i = 0; i < length; i++) {
+		j = (g_reverse == TRUE) ? (length - 1 - i) : i;
+		if (g_budget == 0) {
+			g_memory[address + j] = g_garbage;
+			longjmp(g_powerCut, 1);
+		}
+		if (g_budget != TEST_NO_LIMIT) {
+			g_budget--;
+		}
+		g_memory[address + j] = data[j];
+	}
+}
+
+/* End the running operation as the TWI interrupt does */
+static void TEST_tick(void) {
+	EEPROM_callback callback = g_callback;
+	uint8 result = SUCCESS;
+
+	if (g_busy == FALSE) {
+		return;
+	}
+
+	if (g_writing == FALSE) {
+		memcpy(g_readData, &g_memory[g_address], g_length);
+	} else if (g_writes - 1 == g_failWrite) {
+		if (g_failProgrammed == TRUE) {
+			TEST_program(g_address, g_page, g_length);
+		}
+		result = ERROR;
+	} else {
+		TEST_program(g_address, g_page, g_length);
+	}
+
+	g_busy = FALSE;
+	g_callback = NULL;
+	if (callback != NULL) {
+		callback(result);
+	}
+}
+
+uint8 EEPROM_writeBlockAsync(uint16 u16addr, const uint8 *data, uint16 length,
+		EEPROM_callback callback) {
+	if (g_busy == TRUE) {
+		return ERROR;
+	}
+	/* The driver copies the data before it returns */
+	memcpy(g_page, data, length);
+	g_writing = TRUE;
+	g_address = u16addr;
+	g_length = length;
+	g_callback = callback;
+	g_writes++;
+	g_busy = TRUE;
+	return SUCCESS;
+}
+
+uint8 EEPROM_readBlockAsync(uint16 u16addr, uint8 *data, uint16 length,
+		EEPROM_callback callback) {
+	if (g_busy == TRUE) {
+		return ERROR;
+	}
+	g_writing = FALSE;
+	g_address = u16addr;
+	g_length = length;
+	g_readData = data;
+	g_callback = callback;
+	g_busy = TRUE;
+	return SUCCESS;
+}
+
+/* Result of the blocking operations */
+static uint8 g_blockResult;
+
+static void TEST_blockDone(uint8 result) {
+	g_blockResult = result;
+}
+
+uint8 EEPROM_writeBlock(uint16 u16addr, const uint8 *data, uint16 length) {
+	if (EEPROM_writeBlockAsync(u16addr, data, length, TEST_blockDone)
+			== ERROR) {
+		return ERROR;
+	}
+	TEST_tick();
+	return g_blockResult;
+}
+
+uint8 EEPROM_readBlock(uint16 u16addr, uint8 *data, uint16 length) {
+	if (EEPROM_readBlockAsync(u16addr, data, length, TEST_blockDone)
+			== ERROR) {
+		return ERROR;
+	}
+	TEST_tick();
+	return g_blockResult;
+}
+
+boolean EEPROM_isBusy(void) {
+	return g_busy;
+}
+
+/*******************************************************************************
+ *                      Stubs of the other drivers                             *
+ *******************************************************************************/
+
+/* The next interrupt is the end of the EEPROM operation */
+void IDLE_sleep(void) {
+	TEST_tick();
+}
+
+/* protocol.c (PROTOCOL_crc16) links the UART driver, never used here */
+uint32 Timer_millis(void) {
+	return 0;
+}
+
+/*******************************************************************************
+ *                      Test cases                                             *
+ *******************************************************************************/
+
+#define TEST_ITERATIONS		40
+#define TEST_PATTERNS		6
+#define TEST_PIN_LENGTH		4
+#define TEST_KEY_OTHER		1
+#define TEST_OTHER_LENGTH	2
+
+/* Value of the commit marker, the worst garbage a torn byte can leave */
+#define TEST_COMMITTED		0x5A
+
+static const uint8 g_patterns[TEST_PATTERNS][TEST_PIN_LENGTH] = {
+		{ 1, 1, 1, 1 }, { 2, 2, 2, 2 }, { 3, 3, 3, 3 },
+		{ 4, 4, 4, 4 }, { 5, 5, 5, 5 }, { 6, 6, 6, 6 } };
+
+/* Power on: the EEPROM is idle again, the cache empty, the log scanned */
+static void TEST_boot(void) {
+	SREG = 0;
+	g_busy = FALSE;
+	g_callback = NULL;
+	g_budget = TEST_NO_LIMIT;
+	g_failWrite = TEST_NO_LIMIT;
+	ECACHE_init();
+	CSTORE_init();
+}
+
+/* Write as the protocol task does, the main loop flushes meanwhile */
+static uint8 TEST_write(uint8 key, const uint8 *value, uint8 length) {
+	uint8 result;
+
+	if (CSTORE_writeStart(key, value, length) == ERROR) {
+		return ERROR;
+	}
+	while ((result = CSTORE_writeStep()) == CSTORE_PENDING) {
+		TEST_tick();
+		ECACHE_flushStep();
+	}
+	return result;
+}
+
+/*
+ * Write of step: the PIN for an even step, the other key for an odd one. The
+ * compaction then copies the live record of the other key around the log.
+ */
+static uint8 TEST_step(uint16 step) {
+	uint16 i = step / 2;
+
+	if ((step % 2) == 0) {
+		return TEST_write(CSTORE_KEY_PIN, g_patterns[i % TEST_PATTERNS],
+				TEST_PIN_LENGTH);
+	}
+	return TEST_write(TEST_KEY_OTHER, g_patterns[(i + 3) % TEST_PATTERNS],
+			TEST_OTHER_LENGTH);
+}
+
+/* The value of key is the one of step (or the key was never written if -1) */
+static boolean TEST_holds(uint8 key, long step) {
+	uint8 value[CSTORE_VALUE_SIZE];
+	uint8 length = CSTORE_read(key, value);
+	uint16 i;
+
+	if (step < 0) {
+		return (length == 0);
+	}
+	i = (uint16) (step / 2);
+	if (key == CSTORE_KEY_PIN) {
+		return (length == TEST_PIN_LENGTH)
+				&& (memcmp(value, g_patterns[i % TEST_PATTERNS], length) == 0);
+	}
+	return (length == TEST_OTHER_LENGTH)
+			&& (memcmp(value, g_patterns[(i + 3) % TEST_PATTERNS], length) == 0);
+}
+
+/* Last step of key at or before step, -1 if none */
+static long TEST_lastOf(uint8 key, long step) {
+	while ((step >= 0) && ((uint8) (step % 2) != key)) {
+		step--;
+	}
+	return step;
+}
+
+/* Both keys hold the value of their last step at or before done */
+static boolean TEST_holdsDone(long done) {
+	return TEST_holds(CSTORE_KEY_PIN, TEST_lastOf(CSTORE_KEY_PIN, done))
+			&& TEST_holds(TEST_KEY_OTHER, TEST_lastOf(TEST_KEY_OTHER, done));
+}
+
+/*
+ * Both keys hold the value of their last completed step, the key of the step
+ * cut short may also hold its new value
+ */
+static boolean TEST_consistent(long done) {
+	long running = done + 1;
+	uint8 key;
+
+	for (key = 0; key < CSTORE_KEYS; key++) {
+		if ((TEST_holds(key, TEST_lastOf(key, done)) == FALSE)
+				&& (((uint8) (running % 2) != key)
+						|| (TEST_holds(key, running) == FALSE))) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Replay the history, the power is cut after every byte in turn. Return the
+ * number of runs that read back a value that was never written.
+ */
+static long TEST_powerCut(uint8 garbage, long *runs) {
+	volatile long done;
+	volatile boolean complete;
+	long failures = 0;
+	long budget;
+
+	g_garbage = garbage;
+	for (budget = 0;; budget++) {
+		memset(g_memory, 0xFF, sizeof(g_memory));
+		TEST_boot();
+		done = -1;
+		complete = FALSE;
+
+		g_budget = budget;
+		if (setjmp(g_powerCut) == 0) {
+			for (; done < (2 * TEST_ITERATIONS) - 1; done++) {
+				if (TEST_step((uint16) (done + 1)) != SUCCESS) {
+					break;
+				}
+			}
+			complete = (done == (2 * TEST_ITERATIONS) - 1);
+		}
+		(*runs)++;
+
+		TEST_boot();
+		if (TEST_consistent(done) == FALSE) {
+			if (failures < 5) {
+				printf("power cut after %ld bytes (garbage 0x%02X): wrong value"
+						" after step %ld\n", budget, garbage, done);
+			}
+			failures++;
+		}
+		if (complete == TRUE) {
+			break;
+		}
+	}
+	return failures;
+}
+
+/*
+ * Replay the history, every EEPROM write fails in turn. The write reports
+ * ERROR and keeps the old value, even once the lazy flush has run and after
+ * a reboot. Return the number of runs that got anything else.
+ */
+static long TEST_writeFailure(boolean programmed, long *runs) {
+	long failures = 0;
+	long fail;
+	long done;
+	uint8 result;
+	boolean ok;
+
+	g_failProgrammed = programmed;
+	for (fail = 0;; fail++) {
+		memset(g_memory, 0xFF, sizeof(g_memory));
+		TEST_boot();
+		g_writes = 0;
+		g_failWrite = fail;
+		result = SUCCESS;
+
+		for (done = -1; done < (2 * TEST_ITERATIONS) - 1; done++) {
+			result = TEST_step((uint16) (done + 1));
+			if (result != SUCCESS) {
+				break;
+			}
+		}
+		(*runs)++;
+
+		/* After ERROR, in RAM, once the lazy flush has run and after a reboot */
+		ok = (result == SUCCESS) || TEST_holdsDone(done);
+		if ((result == ERROR) && (ok == TRUE)) {
+			ok = (ECACHE_flush() == SUCCESS);
+			TEST_boot();
+			ok = ok && TEST_holdsDone(done);
+		}
+		if (ok == FALSE) {
+			if (failures < 5) {
+				printf("write %ld failed (%s programmed): wrong value after"
+						" step %ld\n", fail, programmed ? "still" : "not", done);
+			}
+			failures++;
+		}
+		if (result == SUCCESS) {
+			break;
+		}
+	}
+	return failures;
+}
+
+int main(void) {
+	long failures = 0;
+	long runs = 0;
+
+	failures += TEST_powerCut(TEST_COMMITTED, &runs);
+	failures += TEST_powerCut(0x00, &runs);
+	printf("power cut after every byte: %ld runs, %ld failures\n", runs,
+			failures);
+
+	runs = 0;
+	g_reverse = TRUE;
+	failures += TEST_powerCut(TEST_COMMITTED, &runs);
+	failures += TEST_powerCut(0x00, &runs);
+	g_reverse = FALSE;
+	printf("same, pages programmed last byte first: %ld runs, total failures"
+			" %ld\n", runs, failures);
+
+	runs = 0;
+	failures += TEST_writeFailure(FALSE, &runs);
+	failures += TEST_writeFailure(TRUE, &runs);
+	printf("every write failed in turn: %ld runs, total failures %ld\n", runs,
+			failures);
+
+	printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+/******************************************************************************
+ *
+ * Module: PROTOCOL host test
+ *
+ * File Name: protocol_test.c
+ *
+ * Description: Send frames through the byte stuffing of protocol.c and parse
+ * them back after line noise, cut short frames and corrupted bytes, and check
+ * the receive deadline
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "protocol.h"
+#include "timer.h"
+#include <stdio.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                      Simulated line                                         *
+ *******************************************************************************/
+
+#define TEST_LINE_SIZE		1024
+
+/* Bytes queued by PROTOCOL_sendFrame, then read back by PROTOCOL_pollFrame */
+static uint8 g_line[TEST_LINE_SIZE];
+static uint16 g_written = 0;
+static uint16 g_read = 0;
+
+static void TEST_put(uint8 data) {
+	if (g_written < TEST_LINE_SIZE) {
+		g_line[g_written++] = data;
+	}
+}
+
+/*******************************************************************************
+ *                      Stubs of the UART and timer drivers                    *
+ *******************************************************************************/
+
+void UART_sendv(const UART_segment *segments, uint8 count,
+		UART_checksum checksum, uint16 *sum) {
+	uint8 i;
+
+	for (; count != 0; count--, segments++) {
+		for (i = 0; i < segments->length; i++) {
+			TEST_put(segments->data[i]);
+			if (checksum != NULL) {
+				*sum = checksum(*sum, segments->data[i]);
+			}
+		}
+	}
+}
+
+void UART_sendByte(const uint8 data) {
+	TEST_put(data);
+}
+
+uint8 UART_read(uint8 *data, uint8 length) {
+	uint8 count = 0;
+
+	while ((count < length) && (g_read < g_written)) {
+		data[count++] = g_line[g_read++];
+	}
+	return count;
+}
+
+/* Time, and the gap between two bytes when they trickle in (0: at once) */
+static uint32 g_nowMs = 0;
+static uint32 g_gapMs = 0;
+
+UART_status UART_receiveByteTimeout(uint8 *data, uint16 timeout_ms) {
+	if (g_gapMs > timeout_ms) {
+		/* The driver gives up one tick after the timeout */
+		g_nowMs += (uint32) timeout_ms + 1;
+		return UART_TIMEOUT;
+	}
+	g_nowMs += g_gapMs;
+	return (UART_read(data, 1) == 1) ? UART_OK : UART_TIMEOUT;
+}
+
+UART_status UART_takeRxStatus(void) {
+	return UART_OK;
+}
+
+void UART_getErrorCounters(UART_error_counters *counters) {
+	memset(counters, 0, sizeof(*counters));
+}
+
+void UART_clearErrorCounters(void) {
+}
+
+uint32 Timer_millis(void) {
+	return g_nowMs;
+}
+
+/*******************************************************************************
+ *                      Test cases                                             *
+ *******************************************************************************/
+
+/* Payload of frame number n, SOF and ESC show up in most of them */
+static uint8 TEST_payload(uint8 *payload, uint16 n) {
+	uint8 length = (uint8) (n % (PROTOCOL_MAX_PAYLOAD + 1));
+	uint8 i;
+
+	for (i = 0; i < length; i++) {
+		payload[i] = (uint8) (PROTOCOL_ESC + ((n + i) % 3));
+	}
+	return length;
+}
+
+static void TEST_send(uint16 n) {
+	uint8 payload[PROTOCOL_MAX_PAYLOAD];
+	uint8 length = TEST_payload(payload, n);
+
+	PROTOCOL_sendFrame(MSG_REQUEST, payload, length);
+}
+
+/* Parse everything on the line, 1 if the frames found are not just frame n */
+static int TEST_expect(uint16 n) {
+	PROTOCOL_frame frame;
+	uint8 payload[PROTOCOL_MAX_PAYLOAD];
+	uint8 length = TEST_payload(payload, n);
+	uint8 found = 0;
+	int failed = 0;
+
+	while (PROTOCOL_pollFrame(&frame) == TRUE) {
+		found++;
+		if ((frame.type != MSG_REQUEST) || (frame.length != length)
+				|| (memcmp(frame.payload, payload, length) != 0)) {
+			failed = 1;
+		}
+	}
+	g_written = 0;
+	g_read = 0;
+	return failed || (found != 1);
+}
+
+/* Every payload length, made of SOF, ESC and the byte between them */
+static int TEST_roundTrip(void) {
+	int failures = 0;
+	uint16 n;
+	uint16 i;
+
+	for (n = 0; n < 3 * (PROTOCOL_MAX_PAYLOAD + 1); n++) {
+		TEST_send(n);
+		/* Only the first byte of the frame may be a SOF */
+		for (i = 1; i < g_written; i++) {
+			if (g_line[i] == PROTOCOL_SOF) {
+				failures++;
+			}
+		}
+		failures += TEST_expect(n);
+	}
+	printf("%-52s %s\n", "round trip of SOF and ESC in every position",
+			(failures == 0) ? "ok" : "FAIL");
+	return failures;
+}
+
+/*
+ * A noise SOF followed by up to a frame worth of junk, then the real frame.
+ * Junk bytes up to PROTOCOL_MAX_PAYLOAD are taken for a length and make the
+ * parser swallow the bytes after them.
+ */
+static int TEST_noise(void) {
+	int failures = 0;
+	uint16 junk;
+	uint16 value;
+	uint16 i;
+
+	for (junk = 0; junk <= PROTOCOL_MAX_PAYLOAD + 4; junk++) {
+		for (value = 0; value < 256; value++) {
+			if ((value == PROTOCOL_SOF) || (value == PROTOCOL_ESC)) {
+				continue;
+			}
+			TEST_put(PROTOCOL_SOF);
+			for (i = 0; i < junk; i++) {
+				TEST_put((uint8) ((i == 1) ? (value % 17) : value));
+			}
+			TEST_send(junk + 3);
+			failures += TEST_expect(junk + 3);
+		}
+	}
+	printf("%-52s %s\n", "noise SOF and junk before a frame",
+			(failures == 0) ? "ok" : "FAIL");
+	return failures;
+}
+
+/* Frame cut after every byte (a lost byte), then the next frame */
+static int TEST_cut(void) {
+	int failures = 0;
+	uint16 length;
+	uint16 cut;
+
+	TEST_send(PROTOCOL_MAX_PAYLOAD);
+	length = g_written;
+	g_written = 0;
+
+	for (cut = 1; cut < length; cut++) {
+		TEST_send(PROTOCOL_MAX_PAYLOAD);
+		g_written = cut;
+		TEST_send(5);
+		failures += TEST_expect(5);
+	}
+	printf("%-52s %s\n", "frame cut short after every byte",
+			(failures == 0) ? "ok" : "FAIL");
+	return failures;
+}
+
+/* One byte of a frame corrupted, in every position, then the next frame */
+static int TEST_corrupt(void) {
+	PROTOCOL_frame frame;
+	int failures = 0;
+	uint16 length;
+	uint16 position;
+	uint8 bit;
+
+	TEST_send(PROTOCOL_MAX_PAYLOAD);
+	length = g_written;
+	g_written = 0;
+
+	for (position = 1; position < length; position++) {
+		for (bit = 0; bit < 8; bit++) {
+			TEST_send(PROTOCOL_MAX_PAYLOAD);
+			g_line[position] ^= (uint8) (1 << bit);
+			TEST_send(5);
+
+			/* The broken frame never passes, the next one always does */
+			if ((PROTOCOL_pollFrame(&frame) == FALSE)
+					|| (frame.length != 5)) {
+				failures++;
+			}
+			g_written = 0;
+			g_read = 0;
+		}
+	}
+	printf("%-52s %s\n", "one bit flipped in every byte of a frame",
+			(failures == 0) ? "ok" : "FAIL");
+	return failures;
+}
+
+/*
+ * Noise bytes come in just before the byte timeout each time, the call must
+ * still end at its own deadline
+ */
+static int TEST_deadline(void) {
+	PROTOCOL_frame frame;
+	UART_status status;
+	int failed;
+	uint16 i;
+
+	for (i = 0; i < 16; i++) {
+		TEST_put(0x55);
+	}
+	g_nowMs = 0;
+	g_gapMs = PROTOCOL_RESPONSE_TIMEOUT_MS - 1;
+	status = PROTOCOL_receiveFrame(&frame, PROTOCOL_RESPONSE_TIMEOUT_MS);
+	g_gapMs = 0;
+	g_written = 0;
+	g_read = 0;
+
+	failed = (status != UART_TIMEOUT)
+			|| (g_nowMs > PROTOCOL_RESPONSE_TIMEOUT_MS + 1);
+	printf("%-52s %s\n", "byte trickle, receive ends at its deadline",
+			failed ? "FAIL" : "ok");
+	return failed;
+}
+
+int main(void) {
+	PROTOCOL_link_statistics stats;
+	int failures = 0;
+
+	failures += TEST_roundTrip();
+	failures += TEST_noise();
+	failures += TEST_cut();
+	failures += TEST_corrupt();
+	failures += TEST_deadline();
+
+	PROTOCOL_getLinkStatistics(&stats);
+	printf("frames received %u rejected %u\n", stats.frames_received,
+			stats.frames_rejected);
+
+	printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+	return (failures == 0) ? 0 : 1;
+}
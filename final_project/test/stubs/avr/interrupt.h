@@ -0,0 +1,25 @@
+/******************************************************************************
+ *
+ * Module: Host test stubs
+ *
+ * File Name: interrupt.h
+ *
+ * Description: An ISR is a plain function the test calls to raise the
+ * interrupt, cli and sei only move the I bit of the SREG variable
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef STUB_AVR_INTERRUPT_H_
+#define STUB_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)	void vector(void); void vector(void)
+#define ISR_NAKED
+
+#define sei()				(SREG |= (1 << 7))
+#define cli()				(SREG &= (unsigned char) ~(1 << 7))
+
+#endif /* STUB_AVR_INTERRUPT_H_ */
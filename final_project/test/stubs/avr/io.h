@@ -0,0 +1,104 @@
+/******************************************************************************
+ *
+ * Module: Host test stubs
+ *
+ * File Name: io.h
+ *
+ * Description: ATmega16 registers as plain variables for the host tests,
+ * defined in registers.c
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef STUB_AVR_IO_H_
+#define STUB_AVR_IO_H_
+
+extern volatile unsigned char UDR, UCSRA, UCSRB, UCSRC, UBRRH, UBRRL;
+extern volatile unsigned char TCNT0, TCCR0, OCR0, TIMSK, TIFR;
+extern volatile unsigned char TCCR1A, TCCR1B, TCCR2, TCNT2, OCR2, ASSR;
+extern volatile unsigned short TCNT1, OCR1A, OCR1B;
+extern volatile unsigned char TWBR, TWSR, TWAR, TWCR, TWDR;
+extern volatile unsigned char PORTA, PORTB, PORTC, PORTD;
+extern volatile unsigned char DDRA, DDRB, DDRC, DDRD;
+extern volatile unsigned char PINA, PINB, PINC, PIND;
+extern volatile unsigned char SREG, MCUCR, SPL, SPH;
+
+/* UCSRA */
+#define RXC		7
+#define TXC		6
+#define UDRE	5
+#define FE		4
+#define DOR		3
+#define PE		2
+#define U2X		1
+#define MPCM	0
+
+/* UCSRB */
+#define RXCIE	7
+#define TXCIE	6
+#define UDRIE	5
+#define RXEN	4
+#define TXEN	3
+#define UCSZ2	2
+#define RXB8	1
+#define TXB8	0
+
+/* UCSRC */
+#define URSEL	7
+#define UMSEL	6
+#define UPM1	5
+#define UPM0	4
+#define USBS	3
+#define UCSZ1	2
+#define UCSZ0	1
+#define UCPOL	0
+
+/* TCCR0 */
+#define FOC0	7
+#define WGM00	6
+#define COM01	5
+#define COM00	4
+#define WGM01	3
+#define CS02	2
+#define CS01	1
+#define CS00	0
+
+/* TIMSK and TIFR */
+#define OCIE2	7
+#define TOIE2	6
+#define TICIE1	5
+#define OCIE1A	4
+#define OCIE1B	3
+#define TOIE1	2
+#define OCIE0	1
+#define TOIE0	0
+#define OCF2	7
+#define TOV2	6
+#define OCF0	1
+#define TOV0	0
+
+/* TCCR1A and TCCR2 */
+#define COM1A1	7
+#define COM1A0	6
+#define FOC1A	3
+#define FOC1B	2
+#define FOC2	7
+#define WGM20	6
+#define COM21	5
+#define COM20	4
+#define WGM21	3
+
+/* TWCR */
+#define TWINT	7
+#define TWEA	6
+#define TWSTA	5
+#define TWSTO	4
+#define TWWC	3
+#define TWEN	2
+#define TWIE	0
+
+#define SE		6
+#define RAMEND	0x45F
+
+#endif /* STUB_AVR_IO_H_ */
@@ -0,0 +1,24 @@
+/******************************************************************************
+ *
+ * Module: Host test stubs
+ *
+ * File Name: pgmspace.h
+ *
+ * Description: Flash tables are ordinary constants on the host
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef STUB_AVR_PGMSPACE_H_
+#define STUB_AVR_PGMSPACE_H_
+
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(address)	(*(const unsigned char *) (address))
+#define pgm_read_word(address)	(*(const unsigned short *) (address))
+#define pgm_read_ptr(address)	(*(void * const *) (address))
+#define memcpy_P				memcpy
+
+#endif /* STUB_AVR_PGMSPACE_H_ */
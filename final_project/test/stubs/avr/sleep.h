@@ -0,0 +1,23 @@
+/******************************************************************************
+ *
+ * Module: Host test stubs
+ *
+ * File Name: sleep.h
+ *
+ * Description: Sleep mode control, nothing to do on the host
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef STUB_AVR_SLEEP_H_
+#define STUB_AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE		0
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+#endif /* STUB_AVR_SLEEP_H_ */
@@ -0,0 +1,23 @@
+/******************************************************************************
+ *
+ * Module: Host test stubs
+ *
+ * File Name: registers.c
+ *
+ * Description: Storage of the stub ATmega16 registers
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include <avr/io.h>
+
+volatile unsigned char UDR, UCSRA, UCSRB, UCSRC, UBRRH, UBRRL;
+volatile unsigned char TCNT0, TCCR0, OCR0, TIMSK, TIFR;
+volatile unsigned char TCCR1A, TCCR1B, TCCR2, TCNT2, OCR2, ASSR;
+volatile unsigned short TCNT1, OCR1A, OCR1B;
+volatile unsigned char TWBR, TWSR, TWAR, TWCR, TWDR;
+volatile unsigned char PORTA, PORTB, PORTC, PORTD;
+volatile unsigned char DDRA, DDRB, DDRC, DDRD;
+volatile unsigned char PINA, PINB, PINC, PIND;
+volatile unsigned char SREG, MCUCR, SPL, SPH;
@@ -0,0 +1,19 @@
+/******************************************************************************
+ *
+ * Module: Host test stubs
+ *
+ * File Name: delay.h
+ *
+ * Description: Busy-wait delays, they return at once on the host
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#ifndef STUB_UTIL_DELAY_H_
+#define STUB_UTIL_DELAY_H_
+
+#define _delay_ms(ms)		((void) (ms))
+#define _delay_us(us)		((void) (us))
+
+#endif /* STUB_UTIL_DELAY_H_ */
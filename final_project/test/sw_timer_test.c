@@ -0,0 +1,220 @@
+/******************************************************************************
+ *
+ * Module: SW_TIMER host test
+ *
+ * File Name: sw_timer_test.c
+ *
+ * Description: Start and cancel timers at random against a plain model of
+ * their expiry ticks, and cancel or restart timers from the callbacks
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "sw_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*******************************************************************************
+ *                      Stubs of the Timer0 driver                             *
+ *******************************************************************************/
+
+timer_subscriber_id Timer_subscribe(timer_vector vector, void (*a_ptr)(void),
+		uint8 divider) {
+	(void) vector;
+	(void) a_ptr;
+	(void) divider;
+	return 0;
+}
+
+void Timer_unsubscribe(timer_subscriber_id id) {
+	(void) id;
+}
+
+/*******************************************************************************
+ *                      Test timers                                            *
+ *******************************************************************************/
+
+#define TEST_TICKS			200000UL
+#define TEST_NOT_RUNNING	0UL
+
+/* Model of each test timer: next expiry tick (TEST_NOT_RUNNING) and period */
+static uint32 g_now = 0;
+static uint32 g_due[SW_TIMER_MAX];
+static uint32 g_period[SW_TIMER_MAX];
+static SW_timer_id g_ids[SW_TIMER_MAX];
+
+/* Callbacks run in the current tick, in order */
+static uint8 g_fired[SW_TIMER_MAX];
+static uint8 g_firedCount = 0;
+static uint32 g_lateFires = 0;
+
+/* Action of a callback in the directed cases, run after it is recorded */
+static void (*g_onFire[SW_TIMER_MAX])(void);
+
+static void TEST_fired(uint8 k) {
+	if (g_firedCount < SW_TIMER_MAX) {
+		g_fired[g_firedCount++] = k;
+	} else {
+		g_lateFires++;
+	}
+	if (g_onFire[k] != NULL) {
+		g_onFire[k]();
+	}
+}
+
+#define TEST_CALLBACK(k)	static void TEST_callback##k(void) { TEST_fired(k); }
+TEST_CALLBACK(0)
+TEST_CALLBACK(1)
+TEST_CALLBACK(2)
+TEST_CALLBACK(3)
+TEST_CALLBACK(4)
+TEST_CALLBACK(5)
+TEST_CALLBACK(6)
+TEST_CALLBACK(7)
+
+static void (* const g_callbacks[SW_TIMER_MAX])(void) = { TEST_callback0,
+		TEST_callback1, TEST_callback2, TEST_callback3, TEST_callback4,
+		TEST_callback5, TEST_callback6, TEST_callback7 };
+
+static void TEST_start(uint8 k, uint32 ticks, uint32 period) {
+	g_ids[k] = SWTIMER_start(ticks, period, g_callbacks[k]);
+	g_due[k] = g_now + ((ticks == 0) ? 1 : ticks);
+	g_period[k] = period;
+}
+
+static void TEST_cancel(uint8 k) {
+	SWTIMER_cancel(g_ids[k]);
+	g_due[k] = TEST_NOT_RUNNING;
+}
+
+static void TEST_reset(void) {
+	uint8 k;
+
+	SWTIMER_init();
+	g_now = 0;
+	for (k = 0; k < SW_TIMER_MAX; k++) {
+		g_due[k] = TEST_NOT_RUNNING;
+		g_onFire[k] = NULL;
+	}
+}
+
+/* One tick, 1 if the callbacks run are not the timers due in the model */
+static int TEST_tick(void) {
+	uint8 expected = 0;
+	uint8 got = 0;
+	uint8 k;
+
+	g_now++;
+	g_firedCount = 0;
+	SWTIMER_tick();
+
+	for (k = 0; k < g_firedCount; k++) {
+		got |= (uint8) (1 << g_fired[k]);
+	}
+	for (k = 0; k < SW_TIMER_MAX; k++) {
+		if (g_due[k] == g_now) {
+			expected |= (uint8) (1 << k);
+			g_due[k] = (g_period[k] != 0) ? g_now + g_period[k]
+					: TEST_NOT_RUNNING;
+		}
+	}
+	return (got != expected) || (g_firedCount != __builtin_popcount(got));
+}
+
+/*******************************************************************************
+ *                      Test cases                                             *
+ *******************************************************************************/
+
+/* Lengths around the wheel size and its multiples, where slots wrap */
+static uint32 TEST_length(void) {
+	switch (rand() % 4) {
+	case 0:
+		return (uint32) (rand() % 4);
+	case 1:
+		return (uint32) (rand() % (3 * SW_TIMER_WHEEL_SIZE));
+	case 2:
+		return (uint32) (SW_TIMER_WHEEL_SIZE * (rand() % 8) + rand() % 3);
+	default:
+		return (uint32) (rand() % 2000);
+	}
+}
+
+static int TEST_random(void) {
+	int failures = 0;
+	uint32 i;
+	uint8 k;
+
+	TEST_reset();
+	srand(1);
+	for (i = 0; i < TEST_TICKS; i++) {
+		k = (uint8) (rand() % SW_TIMER_MAX);
+		switch (rand() % 8) {
+		case 0:
+			if (g_due[k] == TEST_NOT_RUNNING) {
+				TEST_start(k, TEST_length(),
+						(rand() % 2) ? 0 : TEST_length());
+			}
+			break;
+		case 1:
+			if (g_due[k] != TEST_NOT_RUNNING) {
+				TEST_cancel(k);
+			}
+			break;
+		default:
+			break;
+		}
+		failures += TEST_tick();
+	}
+	printf("%-52s %s\n", "random start and cancel against the model",
+			(failures == 0) ? "ok" : "FAIL");
+	return failures;
+}
+
+static void TEST_cancelOne(void) {
+	TEST_cancel(1);
+}
+
+static void TEST_restartOne(void) {
+	TEST_cancel(1);
+	TEST_start(1, 5, 0);
+}
+
+/*
+ * Timers 0 and 1 expire in the same tick, 0 first. The callback of 0 cancels
+ * (or cancels and restarts) 1, which must then not run in that tick.
+ */
+static int TEST_cancelInCallback(void (*action)(void), uint32 period,
+		const char *name) {
+	int failures = 0;
+	uint32 i;
+
+	TEST_reset();
+	g_onFire[0] = action;
+	TEST_start(0, 3 * SW_TIMER_WHEEL_SIZE, 0);
+	TEST_start(1, 3 * SW_TIMER_WHEEL_SIZE, period);
+	/* Another timer in the same slot, later, must still run */
+	TEST_start(2, 4 * SW_TIMER_WHEEL_SIZE, 0);
+
+	for (i = 0; i < 6 * SW_TIMER_WHEEL_SIZE; i++) {
+		failures += TEST_tick();
+	}
+	failures += (g_lateFires != 0);
+	printf("%-52s %s\n", name, (failures == 0) ? "ok" : "FAIL");
+	return failures;
+}
+
+int main(void) {
+	int failures = 0;
+
+	failures += TEST_random();
+	failures += TEST_cancelInCallback(TEST_cancelOne, 0,
+			"one-shot cancelled by an earlier callback");
+	failures += TEST_cancelInCallback(TEST_cancelOne, 7,
+			"periodic cancelled by an earlier callback");
+	failures += TEST_cancelInCallback(TEST_restartOne, 0,
+			"cancelled and restarted by an earlier callback");
+
+	printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/******************************************************************************
+ *
+ * Module: UART host test
+ *
+ * File Name: uart_test.c
+ *
+ * Description: Drive the Rx ISR of uart.c at full line rate against the
+ * consumers of the ECUs and check that no byte is dropped
+ *
+ * Author: Hussein Mohamed
+ *
+ *******************************************************************************/
+
+#include "uart.h"
+#include "idle.h"
+#include "timer.h"
+#include <stdio.h>
+
+/*******************************************************************************
+ *                      Simulated line and time                                *
+ *******************************************************************************/
+
+/*
+ * Frame format of both ECUs: start, 9 data, even parity and stop bits, 12 bits
+ * per character. Every character follows the previous one without any idle
+ * time, the fastest the other ECU can send.
+ */
+#define CHARACTER_BITS		12ULL
+#define CHARACTER_NS		(CHARACTER_BITS * 1000000000ULL / USART_BAUDRATE)
+
+#define TEST_BYTES			4096
+
+void USART_RXC_vect(void);
+
+static unsigned long long g_nowNs = 0;
+static unsigned long long g_nextByteNs = CHARACTER_NS;
+
+/* Bytes put on the line, and bytes the consumer got back */
+static uint32 g_sent = 0;
+static uint32 g_received = 0;
+static uint32 g_mismatches = 0;
+
+/* First receive error the consumer took */
+static UART_status g_rxError = UART_OK;
+
+/* Pseudo random line data, every value including 0x00 and 0xFF shows up */
+static uint8 TEST_byte(uint32 index) {
+	return (uint8) ((index * 151U) ^ (index >> 8));
+}
+
+/* Raise the Rx interrupt for every byte whose stop bit is in before now */
+static void TEST_runLine(void) {
+	while ((g_nextByteNs <= g_nowNs) && (g_sent < TEST_BYTES)) {
+		/* A data frame, RXB8 (the 9th bit) is clear */
+		UCSRA = (1 << RXC);
+		UDR = TEST_byte(g_sent);
+		USART_RXC_vect();
+		g_sent++;
+		g_nextByteNs += CHARACTER_NS;
+	}
+}
+
+/* The consumer keeps the CPU busy for us, the ISR still runs meanwhile */
+static void TEST_busy(uint32 us) {
+	g_nowNs += (unsigned long long) us * 1000ULL;
+	TEST_runLine();
+}
+
+static void TEST_check(uint8 data) {
+	if (data != TEST_byte(g_received)) {
+		g_mismatches++;
+	}
+	g_received++;
+}
+
+/*******************************************************************************
+ *                      Stubs of the other drivers                             *
+ *******************************************************************************/
+
+/* The next interrupt is the next received byte */
+void IDLE_sleep(void) {
+	if ((g_nextByteNs > g_nowNs) && (g_sent < TEST_BYTES)) {
+		g_nowNs = g_nextByteNs;
+	} else {
+		g_nowNs += 1000000ULL;
+	}
+	TEST_runLine();
+}
+
+uint32 Timer_millis(void) {
+	return (uint32) (g_nowNs / 1000000ULL);
+}
+
+/*******************************************************************************
+ *                      Test cases                                             *
+ *******************************************************************************/
+
+static void TEST_start(void) {
+	USART_configuration config = { ENABLED_EVEN, BIT_1, BIT_9, ASYNCH, FALLING };
+
+	UART_init(&config);
+	UART_clearErrorCounters();
+	(void) UART_takeRxStatus();
+	g_nowNs = 0;
+	g_nextByteNs = CHARACTER_NS;
+	g_sent = 0;
+	g_received = 0;
+	g_mismatches = 0;
+	g_rxError = UART_OK;
+}
+
+/*
+ * Run one consumer over TEST_BYTES bytes, report and return 1 if the result
+ * is not the expected one: no drop at all, or some drops when
+ * expect_drops is set (the check that the counter really sees them).
+ */
+static int TEST_report(const char *name, boolean expect_drops) {
+	UART_error_counters counters;
+	uint8 rx_high;
+	uint8 tx_high;
+	int failed;
+
+	UART_getErrorCounters(&counters);
+	UART_getBufferHighWater(&rx_high, &tx_high);
+	if (g_rxError == UART_OK) {
+		g_rxError = UART_takeRxStatus();
+	}
+
+	if (expect_drops == TRUE) {
+		failed = (counters.buffer_overflows == 0)
+				|| (g_rxError != UART_OVERFLOW);
+	} else {
+		failed = (counters.buffer_overflows != 0) || (g_mismatches != 0)
+				|| (g_received != TEST_BYTES) || (g_rxError != UART_OK);
+	}
+
+	printf("%-44s sent %4lu received %4lu dropped %4u high water %2u/%u %s\n",
+			name, (unsigned long) g_sent, (unsigned long) g_received,
+			counters.buffer_overflows, rx_high, UART_RX_BUFFER_SIZE,
+			failed ? "FAIL" : "ok");
+	return failed;
+}
+
+/* Blocking receive, one byte per call as RECEIVE_PW used to do */
+static int TEST_blocking(void) {
+	TEST_start();
+	while (g_received < TEST_BYTES) {
+		TEST_check(UART_recieveByte());
+	}
+	return TEST_report("blocking UART_recieveByte", FALSE);
+}
+
+/* Receive with a timeout, as the protocol layer does */
+static int TEST_timeout(void) {
+	uint8 data;
+
+	TEST_start();
+	while (g_received < TEST_BYTES) {
+		if (UART_receiveByteTimeout(&data, 100) != UART_OK) {
+			break;
+		}
+		TEST_check(data);
+	}
+	return TEST_report("UART_receiveByteTimeout", FALSE);
+}
+
+/*
+ * Main loop that drains the buffer with UART_read once per pass and is busy
+ * for stall_us in between (LCD updates, motor control, EEPROM writes ...)
+ */
+static int TEST_polling(uint32 stall_us, boolean expect_drops) {
+	char name[64];
+	UART_status status;
+	uint8 data[8];
+	uint8 count;
+	uint8 i;
+
+	TEST_start();
+	while ((g_sent < TEST_BYTES) || (UART_available() != 0)) {
+		count = UART_read(data, sizeof(data));
+		for (i = 0; i < count; i++) {
+			TEST_check(data[i]);
+		}
+		if (count == 0) {
+			/* UART_read stops at a receive error, take it to read on */
+			status = UART_takeRxStatus();
+			if (status == UART_OK) {
+				/* Nothing left, sleep until the next byte */
+				IDLE_sleep();
+			} else if (g_rxError == UART_OK) {
+				g_rxError = status;
+			}
+		} else if (UART_available() == 0) {
+			TEST_busy(stall_us);
+		}
+	}
+
+	sprintf(name, "UART_read, %lu us busy between passes",
+			(unsigned long) stall_us);
+	return TEST_report(name, expect_drops);
+}
+
+/*
+ * A byte with a parity error between good ones: the bytes before it come
+ * first, then the error, then the bytes after it
+ */
+static int TEST_errorOrder(void) {
+	UART_status status;
+	uint8 data;
+	uint8 i;
+	int failed = 0;
+
+	TEST_start();
+	g_sent = TEST_BYTES;
+	for (i = 0; i < 7; i++) {
+		UCSRA = (1 << RXC) | ((i == 3) ? (1 << PE) : 0);
+		UDR = i;
+		USART_RXC_vect();
+	}
+
+	for (i = 0; i < 7; i++) {
+		status = UART_receiveByteTimeout(&data, 10);
+		if (i == 3) {
+			failed |= (status != UART_PARITY_ERROR);
+		} else {
+			failed |= (status != UART_OK) || (data != i);
+		}
+	}
+	failed |= (UART_receiveByteTimeout(&data, 10) != UART_TIMEOUT);
+
+	printf("%-44s %s\n", "parity error reported after the bytes before it",
+			failed ? "FAIL" : "ok");
+	return failed;
+}
+
+int main(void) {
+	/* The buffer holds UART_RX_BUFFER_SIZE characters, the main loop may stay
+	 * away for that long minus one character of margin */
+	uint32 budget_us = (uint32) (((UART_RX_BUFFER_SIZE - 1) * CHARACTER_NS)
+			/ 1000ULL);
+	int failures = 0;
+
+	SREG = 0;
+	printf("line rate %u baud, %llu us per character\n", USART_BAUDRATE,
+			CHARACTER_NS / 1000ULL);
+
+	failures += TEST_blocking();
+	failures += TEST_timeout();
+	failures += TEST_polling(0, FALSE);
+	failures += TEST_polling(1000, FALSE);
+	failures += TEST_polling(budget_us, FALSE);
+
+	/* Staying away longer than the buffer lasts must show up as drops */
+	failures += TEST_polling(budget_us + (uint32) (3 * CHARACTER_NS / 1000ULL),
+			TRUE);
+
+	failures += TEST_errorOrder();
+
+	printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+	return (failures == 0) ? 0 : 1;
+}